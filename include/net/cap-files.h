@@ -33,6 +33,20 @@ typedef struct {
 	int32_t tv_usec;
 } pcap_timeval_t;
 
+/* tcpdump (libpcap) file preamble */
+#define TCPDUMP_MAGIC		0xa1b2c3d4	/* microsecond timestamps */
+#define TCPDUMP_LINKTYPE_ETHERNET	1
+
+typedef struct {
+	uint32_t		magic;
+	uint16_t		version_major;
+	uint16_t		version_minor;
+	int32_t			thiszone;
+	uint32_t		sigfigs;
+	uint32_t		snaplen;
+	uint32_t		linktype;
+} __attribute__((packed)) tcpdump_file_header_t;
+
 typedef struct {
 	pcap_timeval_t		tv_last;
 	uint32_t		len;
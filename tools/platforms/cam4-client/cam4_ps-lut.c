@@ -24,9 +24,31 @@
  *       Component for conform portion of the system.
 \*/
 
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <compiler.h>
 #include "cam4_ps-lut.h"
 
+/* big endian word of the packed stream, src need not be aligned */
+static inline uint32_t get32(const uint8_t *s)
+{
+	uint32_t	v;
+
+	memcpy(&v, s, sizeof(v));
+	return ntohl(v);
+}
+
+static inline uint16_t get16(const uint8_t *s)
+{
+	uint16_t	v;
+
+	memcpy(&v, s, sizeof(v));
+	return ntohs(v);
+}
+
 /*http://wiki.vocord.com/spec-fmt-video#5_raw_raw_curve_ */
 /*********************************************************/
 /*  Reduce bits from 16 to 8	 			 */
@@ -67,326 +89,1151 @@ static inline uint_fast8_t lut(
 
 static inline void unpack_8(
 	uint16_t *s16,
-	uint32_t *s,
+	const uint8_t *d,
 	size_t	 size)
 {
-    	uint8_t *d; int i;
-	d = (uint8_t*)s;
+    	int i;
 	for(i=0;i<size;i++)
     		s16[i] = d[i];
 }
 
-static inline void LUT_10_to_8(
-	uint16_t *d16,
-	uint32_t *s,
-	size_t	 size,
-	uint16_t curve_s0,
-	uint16_t curve_s1,
-	uint16_t curve_s2,
-	uint16_t curve_th0,
-	uint16_t curve_th1,
-	uint16_t curve_th2,
-	uint16_t curve_shift0,
-	uint16_t curve_shift1,
-	uint16_t curve_shift2
-)
+/*
+ * Tone curve of CAM4_LUT_GAMMA, evaluated once per table entry.  The log
+ * shoulder y = ky + (1 - ky) * log(1 + c * u) / log(1 + c) over u from
+ * 0 to 1 above the knee takes c so that it starts with the slope the
+ * gamma segment ends with; a shoulder that could not is a line.
+ */
+typedef struct {
+	float		black;
+	float		range;
+	float		g;				/* 1 / gamma */
+	float		kx;
+	float		ky;
+	float		c;				/* 0 - a line above the knee */
+} lut_tone_t;
+
+static void lut_tone_init(lut_tone_t *e, const cam4_lut_tone_t *c, unsigned bits)
 {
-	uint32_t	v0, v1, v2, v3, v4, v;
-	uint8_t		*d = (uint8_t *)s;
+	float		white = c->white ? c->white : (1u << bits) - 1;
+	float		slope, lo, hi, m;
+	unsigned	i;
 
-	while(size>=20) {
-		size -= 20;
+	e->black	= c->black;
+	e->range	= white > c->black ? white - c->black : 1;
+	e->g		= 1 / c->gamma;
+	e->kx		= c->knee_x;
+	e->ky		= c->knee_y;
+	e->c		= 0;
 
-		v0 = ntohl(s[0]);
-		v1 = ntohl(s[1]);
-		v2 = ntohl(s[2]);
-		v3 = ntohl(s[3]);
-		v4 = ntohl(s[4]);
+	if(!c->log || e->kx >= 1 || e->ky >= 1)
+		return;
 
-		d16[0] = v = v0>>22;
-		d[0] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	/* c / log(1 + c) grows from 1: bisect it to the slope wanted */
+	slope = e->ky * e->g / e->kx * (1 - e->kx) / (1 - e->ky);
+	if(slope <= 1)
+		return;
 
-		d16[1] = v = (v0>>12) & 0x3ff;
-		d[1] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	for(lo = 1e-6, hi = 1e6, i = 0; i < 64; i++) {
+		m = sqrtf(lo * hi);
+		if(m / log1pf(m) < slope)
+			lo = m;
+		else
+			hi = m;
+	}
+	e->c = lo;
+}
 
-		d16[2] = v = (v0>> 2) & 0x3ff;
-		d[2] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+static uint8_t lut_tone(const lut_tone_t *e, unsigned v)
+{
+	float	x = (v - e->black) / e->range, y, u;
 
-		d16[3] = v = ((v0<<8) & 0x3ff) | (v1>>24);
-		d[3] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	if(v <= e->black)
+		return 0;
+	if(x >= 1)
+		return 255;
 
-		d16[4] = v = (v1>>14) & 0x3ff;
-		d[4] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	if(x < e->kx)
+		y = e->ky * powf(x / e->kx, e->g);
+	else {
+		u = (x - e->kx) / (1 - e->kx);
+		y = e->ky + (1 - e->ky) * (e->c ? log1pf(e->c * u) / log1pf(e->c) : u);
+	}
 
-		d16[5] = v = (v1>>4) & 0x3ff;
-		d[5] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	return y * 255 + 0.5f;
+}
 
-		d16[6] = v = ((v1<<6) & 0x3ff) | (v2>>26);
-		d[6]= lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+/*
+ * The curve of one sample depth evaluated into a table of 2^bits entries.
+ * The 16 bit table is indexed by the big endian word as loaded, so the
+ * swap is only needed for the 16 bit copy.  The piecewise linear curve
+ * takes the sample >> scale: its slope of 1/16 at least is too steep for
+ * 14 bits.
+ *
+ * A frame pins the current table for all of its samples (lut_hold).  A
+ * new curve is built into a table no frame holds and then made current,
+ * so it applies from the next frame on and nobody waits for it but the
+ * one changing it.
+ */
+struct cam4_lut_table_s {
+	uint8_t			*table;
+	volatile unsigned	users;		/* frames on it */
+};
 
-		d16[7] = v = (v2>>16) & 0x3ff;
-		d[7] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+#define LUT_TABLES	3			/* current, the last, one to build */
+#define LUT_WAIT_MS	1000			/* a new curve waits for a table no longer */
 
-		d16[8] = v = (v2>>6) & 0x3ff;
-		d[8] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+typedef struct {
+	unsigned		bits;
+	unsigned		scale;
+	cam4_lut_table_t	buf[LUT_TABLES];
+	cam4_lut_table_t	* volatile cur;	/* NULL - not built yet */
+	cam4_lut_tone_t		tone;
+} lut_depth_t;
 
-		d16[9] = v = ((v2<<4) & 0x3ff) | (v3>>28);
-		d[9] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
-		d16[10] = v = (v3>>18) & 0x3ff;
-		d[10] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+static uint8_t		table_10[LUT_TABLES][1 << 10];
+static uint8_t		table_12[LUT_TABLES][1 << 12];
+static uint8_t		table_14[LUT_TABLES][1 << 14];
+static uint8_t		table_16[LUT_TABLES][1 << 16];
 
-		d16[11] = v = (v3>>8) & 0x3ff;
-		d[11] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+#define LUT_BUFS(t)	{ { t[0] }, { t[1] }, { t[2] } }
+#define LUT_SEG(s0, th0) { CAM4_LUT_SEG, { { s0, 0, 0 }, { th0, 0, 0 }, { 0, 0, 0 } } }
 
-		d16[12] = v = ((v3<<2) & 0x3ff) | (v4>>30);
-		d[12]= lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+static lut_depth_t	depth_10 = { 10, 0, LUT_BUFS(table_10), NULL, LUT_SEG(4,  1024) };
+static lut_depth_t	depth_12 = { 12, 0, LUT_BUFS(table_12), NULL, LUT_SEG(1,  4096) };
+static lut_depth_t	depth_14 = { 14, 2, LUT_BUFS(table_14), NULL, LUT_SEG(1,  4096) };
+static lut_depth_t	depth_16 = { 16, 0, LUT_BUFS(table_16), NULL, LUT_SEG(1, 65535) };
 
-		d16[13] = v = (v4>>20) & 0x3ff;
-		d[13] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+static pthread_mutex_t	lut_lock = PTHREAD_MUTEX_INITIALIZER;
 
-		d16[14] = v = (v4>>10) & 0x3ff;
-		d[14] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+static lut_depth_t *lut_depth(unsigned fmt)
+{
+	switch(fmt & 7) {
+	    case 1:	return &depth_10;
+	    case 2:	return &depth_12;
+	    case 3:	return &depth_14;
+	    case 4:	return &depth_16;
+	}
+
+	return NULL;
+}
+
+/* depth of the samples of layout fmt: the sensor bits when fewer than the field */
+static lut_depth_t *lut_layout(unsigned fmt)
+{
+	unsigned	field = fmt & 7, depth = fmt >> 4 & 7;
+
+	return lut_depth(depth && depth < field ? depth : field);
+}
 
-		d16[15] = v = (v4>>0) & 0x3ff;
-		d[15] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
+static void lut_build(lut_depth_t *l, uint8_t *table)
+{
+	const cam4_lut_curve_t	*c = &l->tone.seg;
+	lut_tone_t		e;
+	unsigned		i, v;
+
+	if(l->tone.shape == CAM4_LUT_GAMMA) {
+		lut_tone_init(&e, &l->tone, l->bits);
+		for(i = 0; i < 1u << l->bits; i++)
+			table[i] = lut_tone(&e, l->bits == 16 ? ntohs(i) : i);
+		return;
+	}
+
+	for(i = 0; i < 1u << l->bits; i++) {
+		v = l->bits == 16 ? ntohs(i) : i;
+		table[i] = lut(v >> l->scale,
+		    c->s[0], c->s[1], c->s[2],
+		    c->th[0], c->th[1], c->th[2],
+		    c->shift[0], c->shift[1], c->shift[2]
 		);
-		d16+=16;
-		d+=16;
-		s+=5;
 	}
 }
 
-static inline void LUT_12_to_8(
-	uint16_t *d16,
-	uint32_t *s,
-	size_t	 size,
-	uint16_t curve_s0,	uint16_t curve_s1,	uint16_t curve_s2,
-	uint16_t curve_th0,	uint16_t curve_th1,	uint16_t curve_th2,
-	uint16_t curve_shift0,	uint16_t curve_shift1,	uint16_t curve_shift2
-)
+/*
+ * tone NULL - build the first table if it is not there yet, that one
+ * never waits.  -2 - frames held every spare table for LUT_WAIT_MS: a
+ * stream stopped in the middle of a frame keeps its table.
+ */
+static int lut_update(lut_depth_t *l, const cam4_lut_tone_t *tone)
 {
-	uint32_t	v0, v1, v2;
-	uint8_t		*d = (uint8_t *)s;
-	uint16_t 	v;
-	while(size >= 12) {
-		size -= 12;
-
-		v0 = ntohl(s[0]);
-		v1 = ntohl(s[1]);
-		v2 = ntohl(s[2]);
-
-		d16[0] = v = v0>>20;
-		d[0] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	cam4_lut_table_t	*b;
+	unsigned		k, ms;
 
-		d16[1] = v = (v0>>8) & 0xfff;
-		d[1] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	/* the last table may still be finishing a frame or two: wait unlocked */
+	for(ms = 0; ; ms++) {
+		pthread_mutex_lock(&lut_lock);
+		if(!tone && l->cur) {
+			pthread_mutex_unlock(&lut_lock);
+			return 0;
+		}
 
-		d16[2] = v = ((v0<<4) & 0xfff) | (v1>>28);
-		d[2] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+		for(k = 0; k < LUT_TABLES; k++) {
+			b = &l->buf[k];
+			if(b != l->cur && !b->users)
+				break;
+		}
+		if(k < LUT_TABLES)
+			break;
+		pthread_mutex_unlock(&lut_lock);
 
-		d16[3] = v = (v1>>16) & 0xfff;
-		d[3] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+		if(ms == LUT_WAIT_MS)
+			return -2;
+		usleep(1000);
+	}
 
-		d16[4] = v = (v1>>4) & 0xfff;
-		d[4] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	if(tone)
+		l->tone = *tone;
+	lut_build(l, b->table);
+	__sync_synchronize();
+	l->cur = b;
+	pthread_mutex_unlock(&lut_lock);
 
-		d16[5] = v = ((v1<<8) & 0xfff) | (v2>>24);
-		d[5]= lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
-		d16[6] = v = (v2>>12) & 0xfff;
-		d[6] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
-		d16[7] = v = (v2>>0) & 0xfff;
-		d[7] = lut(v,
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	return 0;
+}
+
+static cam4_lut_table_t *lut_hold(lut_depth_t *l)
+{
+	cam4_lut_table_t	*t;
+
+	for(;;) {
+		t = l->cur;
+		if(!t) {
+			lut_update(l, NULL);
+			continue;
+		}
+
+		/* pinned unless it stopped being current meanwhile */
+		__sync_fetch_and_add(&t->users, 1);
+		if(t == l->cur)
+			return t;
+		__sync_fetch_and_sub(&t->users, 1);
+	}
+}
+
+cam4_lut_table_t *cam4_lut_hold(unsigned fmt)
+{
+	lut_depth_t	*l = lut_layout(fmt);
+
+	return l ? lut_hold(l) : NULL;
+}
+
+void cam4_lut_drop(cam4_lut_table_t *t)
+{
+	if(t)
+		__sync_fetch_and_sub(&t->users, 1);
+}
+
+int cam4_lut_set_tone(unsigned fmt, const cam4_lut_tone_t *tone)
+{
+	lut_depth_t	*l = lut_depth(fmt);
+
+	if(!l || (tone->shape == CAM4_LUT_GAMMA && (tone->gamma <= 0 ||
+	    tone->knee_x <= 0 || tone->knee_x > 1 || tone->knee_y <= 0 || tone->knee_y > 1)))
+		return -1;
+
+	return lut_update(l, tone);
+}
+
+int cam4_lut_set_curve(unsigned fmt, const cam4_lut_curve_t *curve)
+{
+	cam4_lut_tone_t	tone = { CAM4_LUT_SEG };
+
+	tone.seg = *curve;
+	return cam4_lut_set_tone(fmt, &tone);
+}
+
+/*
+ * FIFO CURVE:bits ... (see cam4_ps -h): the curve of the bits samples
+ *	GAMMA black white gamma [knee_x knee_y [LIN|LOG]]
+ *	SEG s0 s1 s2 th0 th1 th2 shift0 shift1 shift2
+ *	DEFAULT
+ */
+int cam4_lut_command(const char *cmd)
+{
+	cam4_lut_tone_t	tone = { CAM4_LUT_GAMMA };
+	cam4_lut_curve_t *c = &tone.seg;
+	unsigned	bits, fmt;
+	char		shape[16], shoulder[16] = "LIN";
+	int		n;
+
+	if(sscanf(cmd, "%u %15s%n", &bits, shape, &n) < 2 || bits < 10 || bits > 16 || bits & 1)
+		return -1;
+	fmt = (bits - 8) / 2;
+	cmd += n;
+
+	if(!strcmp(shape, "DEFAULT")) {
+		static const cam4_lut_tone_t	def[5] = { {}, LUT_SEG(4, 1024), LUT_SEG(1, 4096),
+			LUT_SEG(1, 4096), LUT_SEG(1, 65535) };
 
-		d+=8;
-		d16+=8;
-		s+=3;
+		return cam4_lut_set_tone(fmt, &def[fmt]);
 	}
+
+	if(!strcmp(shape, "SEG")) {
+		unsigned	v[9];
+
+		if(sscanf(cmd, "%u %u %u %u %u %u %u %u %u",
+		    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]) != 9)
+			return -1;
+
+		tone.shape = CAM4_LUT_SEG;
+		for(n = 0; n < 3; n++) {
+			c->s[n]		= v[n];
+			c->th[n]	= v[3 + n];
+			c->shift[n]	= v[6 + n];
+		}
+		return cam4_lut_set_tone(fmt, &tone);
+	}
+
+	if(strcmp(shape, "GAMMA"))
+		return -1;
+
+	tone.knee_x = tone.knee_y = 1;
+	n = sscanf(cmd, "%u %u %f %f %f %15s", &tone.black, &tone.white, &tone.gamma,
+	    &tone.knee_x, &tone.knee_y, shoulder);
+	if(n != 3 && n != 5 && n != 6)
+		return -1;
+
+	if(!strcmp(shoulder, "LOG"))
+		tone.log = 1;
+	else if(strcmp(shoulder, "LIN"))
+		return -1;
+
+	return cam4_lut_set_tone(fmt, &tone);
+}
+
+/*
+ * Field k: bits [k * field, (k + 1) * field) of s, in two bytes or three.
+ * With k and field constant it is the fixed shifts of a hand written
+ * converter.
+ */
+#define LUT_N_PUT(k)							\
+	do {								\
+		b = (k) * field;					\
+		v = s[b / 8] << 16 | s[b / 8 + 1] << 8;			\
+		if(b % 8 + field > 16)					\
+			v |= s[b / 8 + 2];				\
+		v = v >> (24 - b % 8 - field) & mask;			\
+		if(d16)							\
+			d16[k] = v;					\
+		d[k] = t[v];						\
+	} while(0)
+
+/*
+ * Any packed layout: size bytes of a big endian stream of field bit
+ * samples, 10 to 16, each sample in the low bits of its field (mask).
+ * 16 fields end on a byte, the rest of a group is taken field by field.
+ */
+static __inline__ void LUT_N_to_8(
+	uint16_t *d16,
+	uint8_t	 *d,
+	const uint8_t *s,
+	size_t	 size,
+	const uint8_t *t,
+	unsigned field,
+	unsigned mask
+)
+{
+	size_t		pix = size * 8 / field, k;
+	uint32_t	b, v;
+
+	for(; pix >= 16; pix -= 16) {
+		LUT_N_PUT( 0); LUT_N_PUT( 1); LUT_N_PUT( 2); LUT_N_PUT( 3);
+		LUT_N_PUT( 4); LUT_N_PUT( 5); LUT_N_PUT( 6); LUT_N_PUT( 7);
+		LUT_N_PUT( 8); LUT_N_PUT( 9); LUT_N_PUT(10); LUT_N_PUT(11);
+		LUT_N_PUT(12); LUT_N_PUT(13); LUT_N_PUT(14); LUT_N_PUT(15);
+
+		if(d16)
+			d16 += 16;
+		d += 16;
+		s += field * 2;
+	}
+
+	for(k = 0; k < pix; k++)
+		LUT_N_PUT(k);
 }
 
 static inline void LUT_16_to_8(
 	uint16_t *d16,
-	uint16_t *s,
+	uint8_t	 *d,
+	const uint8_t *s,
 	size_t	 size,
-	uint16_t curve_s0,	uint16_t curve_s1,	uint16_t curve_s2,
-	uint16_t curve_th0,	uint16_t curve_th1,	uint16_t curve_th2,
-	uint16_t curve_shift0,	uint16_t curve_shift1,	uint16_t curve_shift2
+	const uint8_t *t
 )
 {
-	uint8_t		*d = (uint8_t *)s;
+	uint16_t	w;
 
-	while(size>0) {
-	    	d16[0] = ntohs(s[0]);
-		d[0] = lut(d16[0],
-		    curve_s0, curve_s1, curve_s2,
-		    curve_th0, curve_th1, curve_th2,
-		    curve_shift0, curve_shift1, curve_shift2
-		);
+	while(size>1) {
+		memcpy(&w, s, sizeof(w));
+		if(d16)
+			*d16++ = ntohs(w);
+		d[0] = t[w];
 
-		s++;
+		s+=2;
 		d++;
-		d16++;
 		size -= 2;
 	}
 }
 
-void cam4_rd_do_LUT(
-       uint16_t        *raw16,
-       void            *img,
-       uint32_t        fsize
+/*
+ * Vector unpack: whole groups of size bytes at s to 16 bit samples at d16,
+ * bytes done returned.  A kernel never reads past s + size, so it stops
+ * a few groups short; the scalar converters take the rest.
+ */
+typedef size_t unpack_f(uint16_t *d16, const uint8_t *s, size_t size);
+
+typedef struct {
+	const char	*name;
+	unpack_f	*unpack[5];		/* by fmt, NULL - scalar */
+} lut_simd_t;
+
+static const lut_simd_t	lut_scalar = { "scalar" };
+static const lut_simd_t	*lut_simd = &lut_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define cpuid(func,sub,ax,bx,cx,dx)\
+	__asm__ __volatile__ ("cpuid":\
+	"=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func), "c" (sub));
+
+#define LUT_SSSE3	__attribute__((target("ssse3")))
+#define LUT_AVX2	__attribute__((target("avx2")))
+
+/*
+ * The packed formats are a big endian bit stream.  A shuffle puts the two
+ * bytes holding a sample into its 16 bit lane, high byte first; the lane
+ * is then shifted left by the sample's bit offset in the first byte (a
+ * multiply, the offset differs per lane) and right to the sample size.
+ */
+#define SHUF_10		1, 0,  2, 1,  3, 2,  4, 3,  6, 5,  7, 6,  8, 7,  9, 8
+#define MUL_10		1, 4, 16, 64, 1, 4, 16, 64
+#define SHUF_12		1, 0,  2, 1,  4, 3,  5, 4,  7, 6,  8, 7, 10, 9, 11, 10
+#define MUL_12		1, 16, 1, 16, 1, 16, 1, 16
+#define SHUF_16		1, 0,  3, 2,  5, 4,  7, 6,  9, 8, 11, 10, 13, 12, 15, 14
+
+/*
+ * A 14 bit sample at bit offset 4 or 6 spans three bytes: the two bytes
+ * give its top bits as above, the third its low ones through a high
+ * multiply (a right shift by 10 - offset, none for offsets 0 and 2).
+ */
+#define SHUF_14		1, 0,  2, 1,  4, 3,  6, 5,  8, 7,  9, 8, 11, 10, 13, 12
+#define MUL_14		1, 64, 16, 4, 1, 64, 16, 4
+#define SHUF_14_LO	2, -1,  3, -1,  5, -1,  7, -1,  9, -1, 10, -1, 12, -1, 14, -1
+#define MULHI_14	0, 4096, 1024, 0, 0, 4096, 1024, 0
+
+LUT_SSSE3 static size_t unpack8_ssse3(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m128i	z = _mm_setzero_si128();
+	__m128i		v;
+	size_t		n;
+
+	for(n = 0; n + 16 <= size; n += 16, d16 += 16) {
+		v = _mm_loadu_si128((const __m128i *)(s + n));
+		_mm_storeu_si128((__m128i *)d16, _mm_unpacklo_epi8(v, z));
+		_mm_storeu_si128((__m128i *)(d16 + 8), _mm_unpackhi_epi8(v, z));
+	}
+
+	return n;
+}
+
+/* 8 samples of 10 bytes, 16 read */
+LUT_SSSE3 static inline __m128i unpack10_x8(const uint8_t *s)
+{
+	const __m128i	shuf = _mm_setr_epi8(SHUF_10);
+	const __m128i	mul  = _mm_setr_epi16(MUL_10);
+	__m128i		v = _mm_loadu_si128((const __m128i *)s);
+
+	return _mm_srli_epi16(_mm_mullo_epi16(_mm_shuffle_epi8(v, shuf), mul), 6);
+}
+
+LUT_SSSE3 static size_t unpack10_ssse3(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	size_t		n;
+
+	for(n = 0; n + 10 + 16 <= size; n += 20, d16 += 16) {
+		_mm_storeu_si128((__m128i *)d16, unpack10_x8(s + n));
+		_mm_storeu_si128((__m128i *)(d16 + 8), unpack10_x8(s + n + 10));
+	}
+
+	return n;
+}
+
+LUT_SSSE3 static size_t unpack12_ssse3(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m128i	shuf = _mm_setr_epi8(SHUF_12);
+	const __m128i	mul  = _mm_setr_epi16(MUL_12);
+	__m128i		v;
+	size_t		n;
+
+	for(n = 0; n + 16 <= size; n += 12, d16 += 8) {
+		v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + n)), shuf);
+		_mm_storeu_si128((__m128i *)d16, _mm_srli_epi16(_mm_mullo_epi16(v, mul), 4));
+	}
+
+	return n;
+}
+
+/* 8 samples of 14 bytes, 16 read */
+LUT_SSSE3 static inline __m128i unpack14_x8(const uint8_t *s)
+{
+	const __m128i	shuf = _mm_setr_epi8(SHUF_14);
+	const __m128i	mul  = _mm_setr_epi16(MUL_14);
+	const __m128i	lo   = _mm_setr_epi8(SHUF_14_LO);
+	const __m128i	mulhi = _mm_setr_epi16(MULHI_14);
+	__m128i		v = _mm_loadu_si128((const __m128i *)s);
+
+	return _mm_or_si128(
+	    _mm_srli_epi16(_mm_mullo_epi16(_mm_shuffle_epi8(v, shuf), mul), 2),
+	    _mm_mulhi_epu16(_mm_shuffle_epi8(v, lo), mulhi));
+}
+
+LUT_SSSE3 static size_t unpack14_ssse3(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	size_t		n;
+
+	for(n = 0; n + 14 + 16 <= size; n += 28, d16 += 16) {
+		_mm_storeu_si128((__m128i *)d16, unpack14_x8(s + n));
+		_mm_storeu_si128((__m128i *)(d16 + 8), unpack14_x8(s + n + 14));
+	}
+
+	return n;
+}
+
+LUT_SSSE3 static size_t unpack16_ssse3(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m128i	shuf = _mm_setr_epi8(SHUF_16);
+	size_t		n;
+
+	for(n = 0; n + 16 <= size; n += 16, d16 += 8)
+		_mm_storeu_si128((__m128i *)d16,
+		    _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + n)), shuf));
+
+	return n;
+}
+
+/* two 128 bit lanes of s and s + offs */
+LUT_AVX2 static inline __m256i load2x128(const uint8_t *s, unsigned offs)
+{
+	return _mm256_inserti128_si256(
+	    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s)),
+	    _mm_loadu_si128((const __m128i *)(s + offs)), 1);
+}
+
+LUT_AVX2 static size_t unpack8_avx2(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	size_t		n;
+
+	for(n = 0; n + 16 <= size; n += 16, d16 += 16)
+		_mm256_storeu_si256((__m256i *)d16,
+		    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + n))));
+
+	return n;
+}
+
+LUT_AVX2 static size_t unpack10_avx2(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m256i	shuf = _mm256_setr_epi8(SHUF_10, SHUF_10);
+	const __m256i	mul  = _mm256_setr_epi16(MUL_10, MUL_10);
+	__m256i		v;
+	size_t		n;
+
+	for(n = 0; n + 10 + 16 <= size; n += 20, d16 += 16) {
+		v = _mm256_shuffle_epi8(load2x128(s + n, 10), shuf);
+		_mm256_storeu_si256((__m256i *)d16, _mm256_srli_epi16(_mm256_mullo_epi16(v, mul), 6));
+	}
+
+	return n;
+}
+
+LUT_AVX2 static size_t unpack12_avx2(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m256i	shuf = _mm256_setr_epi8(SHUF_12, SHUF_12);
+	const __m256i	mul  = _mm256_setr_epi16(MUL_12, MUL_12);
+	__m256i		v;
+	size_t		n;
+
+	for(n = 0; n + 12 + 16 <= size; n += 24, d16 += 16) {
+		v = _mm256_shuffle_epi8(load2x128(s + n, 12), shuf);
+		_mm256_storeu_si256((__m256i *)d16, _mm256_srli_epi16(_mm256_mullo_epi16(v, mul), 4));
+	}
+
+	return n;
+}
+
+LUT_AVX2 static size_t unpack14_avx2(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m256i	shuf = _mm256_setr_epi8(SHUF_14, SHUF_14);
+	const __m256i	mul  = _mm256_setr_epi16(MUL_14, MUL_14);
+	const __m256i	lo   = _mm256_setr_epi8(SHUF_14_LO, SHUF_14_LO);
+	const __m256i	mulhi = _mm256_setr_epi16(MULHI_14, MULHI_14);
+	__m256i		v;
+	size_t		n;
+
+	for(n = 0; n + 14 + 16 <= size; n += 28, d16 += 16) {
+		v = load2x128(s + n, 14);
+		_mm256_storeu_si256((__m256i *)d16, _mm256_or_si256(
+		    _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(v, shuf), mul), 2),
+		    _mm256_mulhi_epu16(_mm256_shuffle_epi8(v, lo), mulhi)));
+	}
+
+	return n;
+}
+
+LUT_AVX2 static size_t unpack16_avx2(uint16_t *d16, const uint8_t *s, size_t size)
+{
+	const __m256i	shuf = _mm256_setr_epi8(SHUF_16, SHUF_16);
+	size_t		n;
+
+	for(n = 0; n + 32 <= size; n += 32, d16 += 16)
+		_mm256_storeu_si256((__m256i *)d16,
+		    _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(s + n)), shuf));
+
+	return n;
+}
+
+static const lut_simd_t	lut_ssse3 = { "ssse3",
+	{ unpack8_ssse3, unpack10_ssse3, unpack12_ssse3, unpack14_ssse3, unpack16_ssse3 } };
+static const lut_simd_t	lut_avx2 = { "avx2",
+	{ unpack8_avx2, unpack10_avx2, unpack12_avx2, unpack14_avx2, unpack16_avx2 } };
+
+static void lut_probe(void)
+{
+	unsigned	a, b, c, d, max, lo, hi;
+
+	cpuid(0, 0, max, b, c, d);
+	if(max < 1)
+		return;
+
+	cpuid(1, 0, a, b, c, d);
+	if(!(c & 0x200))				/* SSSE3 */
+		return;
+	lut_simd = &lut_ssse3;
+
+	/* AVX2 also needs the OS to keep the ymm state: OSXSAVE, AVX, XCR0 */
+	if(max < 7 || (c & 0x18000000) != 0x18000000)
+		return;
+	__asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	if((lo & 6) != 6)
+		return;
+
+	cpuid(7, 0, a, b, c, d);
+	if(b & 0x20)					/* AVX2 */
+		lut_simd = &lut_avx2;
+}
+#else
+static void lut_probe(void)
+{
+}
+#endif
+
+static pthread_once_t	lut_probe_once = PTHREAD_ONCE_INIT;
+
+#define LUT_BLOCK	256				/* samples unpacked at a time */
+
+/*
+ * Packed fields through the vector unpack, a block at a time into d16 or
+ * on the stack, then masked to the sample and through the table.  Bytes
+ * done returned.
+ */
+static size_t lut_vector(
+	uint16_t	*d16,
+	uint8_t		*d,
+	const uint8_t	*s,
+	size_t		size,
+	unsigned	fmt,
+	unsigned	mask,
+	const uint8_t	*t
 )
 {
-	size_t	 size = fsize & 0xfffffff;
-	switch((fsize>>28) & 7) {
+	unpack_f	*unpack = lut_simd->unpack[fmt];
+	uint16_t	blk[LUT_BLOCK], *o;
+	unsigned	group, gpix;
+	size_t		done = 0, chunk, n, i, pix;
+
+	group	= cam4_lut_group(fmt, &gpix);
+	chunk	= LUT_BLOCK / gpix * group;
+
+	while(done < size) {
+		o	= d16 ? d16 : blk;
+		n	= unpack(o, s + done, size - done < chunk ? size - done : chunk);
+		if(!n)
+			break;
+
+		pix = n / group * gpix;
+		if(mask != 0xffff)
+			for(i = 0; i < pix; i++)
+				o[i] &= mask;
+		for(i = 0; i < pix; i++)
+			d[i] = t[o[i]];
+
+		if(d16)
+			d16 += pix;
+		d	+= pix;
+		done	+= n;
+	}
+
+	return done;
+}
+
+/*
+ * fmt is a sample layout (CAM4_LUT_FMT), h the table held for it, d16
+ * may be NULL, d may be s.  The fields are taken by the vector unpack as
+ * far as it goes, the rest by the bit reader.
+ */
+static void lut_run(
+	uint16_t	*d16,
+	uint8_t		*d,
+	const uint8_t	*s,
+	size_t		size,
+	unsigned	fmt,
+	const cam4_lut_table_t *h
+)
+{
+	unsigned	field = fmt & 7, depth = fmt >> 4 & 7, group, gpix, mask;
+	const uint8_t	*t = h ? h->table : NULL;
+	unpack_f	*unpack;
+	size_t		n = 0, pix;
+
+	pthread_once(&lut_probe_once, lut_probe);
+	unpack = lut_simd->unpack[field];
+
+	if(!depth || depth > field)
+		depth = field;
+
+	switch(field) {
 	    case 0:	/* 8 */
-		unpack_8(raw16,(uint32_t *)img, size);
-		break;
+		if(d16) {
+			if(unpack)
+				n = unpack(d16, s, size);
+			unpack_8(d16 + n, s + n, size - n);
+		}
+		if(d != s)
+			memcpy(d, s, size);
+		return;
 
-	    case 1:	/* 10 */
-		LUT_10_to_8(raw16, (uint32_t *)img, size,
-			    4,		// curve_s0
-			    0,		// curve_s1
-			    0,		// curve_s2
-
-			    1024,	// curve_th0
-			    0,		// curve_th1
-			    0,		// curve_th2
-
-			    0,		// curve_shift0
-			    0,		// curve_shift1
-			    0 		// curve_shift2
-		);
-		break;
+	    case 4:	/* 16 */
+		if(depth < 4)
+			break;
 
-	    case 2:	/* 12 */
-		LUT_12_to_8(raw16, (uint32_t *)img, size,
-			    1,		// curve_s0
-			    0,		// curve_s1
-			    0,		// curve_s2
-
-			    4096,	// curve_th0
-			    0,		// curve_th1
-			    0,		// curve_th2
-
-			    0,		// curve_shift0
-			    0,		// curve_shift1
-			    0 		// curve_shift2
-		);
-		break;
+		/* the table takes the raw word: only the 16 bit copy is swapped */
+		if(d16 && unpack) {
+			n = unpack(d16, s, size);
+			LUT_16_to_8(NULL, d, s, n, t);
+		}
+		LUT_16_to_8(d16 ? d16 + n / 2 : NULL, d + n / 2, s + n, size - n, t);
+		return;
 
+	    case 1:	/* 10 */
+	    case 2:	/* 12 */
 	    case 3:	/* 14 */
 		break;
 
-	    case 4:	/* 16 */
-		LUT_16_to_8(raw16, (uint16_t *)img, size,
-			    1,		// curve_s0
-			    0,		// curve_s1
-			    0,		// curve_s2
-
-			    65535,	// curve_th0
-			    0,		// curve_th1
-			    0,		// curve_th2
-
-			    0,		// curve_shift0
-			    0,		// curve_shift1
-			    0 		// curve_shift2
-		);
+	    default:
+		return;
+	}
+
+	/* packed fields, or 16 bit containers of fewer bits */
+	mask	= (1u << (8 + 2 * depth)) - 1;
+	group	= cam4_lut_group(field, &gpix);
+
+	if(unpack)
+		n = lut_vector(d16, d, s, size, field, mask, t);
+	pix = n / group * gpix;
+
+	switch(field) {
+	    case 1:
+		LUT_N_to_8(d16 ? d16 + pix : NULL, d + pix, s + n, size - n, t, 10, mask);
+		break;
+	    case 2:
+		LUT_N_to_8(d16 ? d16 + pix : NULL, d + pix, s + n, size - n, t, 12, mask);
+		break;
+	    case 3:
+		LUT_N_to_8(d16 ? d16 + pix : NULL, d + pix, s + n, size - n, t, 14, mask);
+		break;
+	    case 4:
+		LUT_N_to_8(d16 ? d16 + pix : NULL, d + pix, s + n, size - n, t, 16, mask);
 		break;
 	}
 }
 
+/*
+ * Stripes (-J): a frame is cut into runs of whole groups, one per thread;
+ * the caller takes the first, the helpers the others.  Out of place only,
+ * in place a stripe would overwrite the samples of the one before it.
+ * One frame is striped at a time, another caller meanwhile runs alone.
+ */
+#define LUT_STRIPES_MAX		16
+#define LUT_STRIPE_MIN		(64 << 10)		/* bytes, smaller frames stay whole */
+
+typedef struct {
+	uint16_t	*d16;
+	uint8_t		*d;
+	const uint8_t	*s;
+	size_t		size;
+	unsigned	fmt;
+	const cam4_lut_table_t *h;
+} lut_stripe_t;
+
+static struct {
+	pthread_mutex_t	busy;				/* a frame is striped */
+	pthread_mutex_t	lock;
+	pthread_cond_t	go;
+	pthread_cond_t	done;
+	unsigned	nthreads;			/* helpers and the caller */
+	unsigned	nstripes;			/* of the frame */
+	unsigned	seq;				/* frames striped */
+	unsigned	left;				/* helper stripes not done */
+	lut_stripe_t	stripe[LUT_STRIPES_MAX];
+} lut_pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 1
+};
+
+static void *lut_helper(void *priv)
+{
+	unsigned	k = (uintptr_t)priv, seq = 0;
+	lut_stripe_t	*st = &lut_pool.stripe[k];
+
+	pthread_mutex_lock(&lut_pool.lock);
+	for(;;) {
+		while(lut_pool.seq == seq)
+			pthread_cond_wait(&lut_pool.go, &lut_pool.lock);
+		seq = lut_pool.seq;
+		if(k >= lut_pool.nstripes)
+			continue;
+
+		pthread_mutex_unlock(&lut_pool.lock);
+		lut_run(st->d16, st->d, st->s, st->size, st->fmt, st->h);
+		pthread_mutex_lock(&lut_pool.lock);
+
+		if(!--lut_pool.left)
+			pthread_cond_signal(&lut_pool.done);
+	}
+
+	return NULL;
+}
+
+int cam4_lut_threads(unsigned n)
+{
+	pthread_t	tid;
+	unsigned	k;
+
+	if(n > LUT_STRIPES_MAX)
+		n = LUT_STRIPES_MAX;
+
+	for(k = lut_pool.nthreads; k < n; k++) {
+		if(pthread_create(&tid, NULL, lut_helper, (void *)(uintptr_t)k))
+			return -1;
+		pthread_detach(tid);
+		lut_pool.nthreads = k + 1;
+	}
 
+	return 0;
+}
+
+/* lut_run() of a frame, striped; the last stripe takes a cut group at the end */
+static void lut_frame(
+	uint16_t	*d16,
+	uint8_t		*d,
+	const uint8_t	*s,
+	size_t		size,
+	unsigned	fmt,
+	const cam4_lut_table_t *h
+)
+{
+	unsigned	group, gpix, n, k;
+	size_t		groups, per, g;
+	lut_stripe_t	*st;
+
+	group	= cam4_lut_group(fmt, &gpix);
+	n	= lut_pool.nthreads;
+	if(size / LUT_STRIPE_MIN < n)
+		n = size / LUT_STRIPE_MIN;
+
+	if(n < 2 || !group || d == s || pthread_mutex_trylock(&lut_pool.busy)) {
+		lut_run(d16, d, s, size, fmt, h);
+		return;
+	}
+
+	groups	= size / group;
+	per	= (groups + n - 1) / n;
+
+	pthread_mutex_lock(&lut_pool.lock);
+	for(k = 0, g = 0; g < groups; k++, g += per) {
+		st		= &lut_pool.stripe[k];
+		st->d16		= d16 ? d16 + g * gpix : NULL;
+		st->d		= d + g * gpix;
+		st->s		= s + g * group;
+		st->size	= g + per < groups ? per * group : size - g * group;
+		st->fmt		= fmt;
+		st->h		= h;
+	}
+	lut_pool.nstripes	= k;
+	lut_pool.left		= k - 1;
+	lut_pool.seq++;
+	pthread_cond_broadcast(&lut_pool.go);
+	pthread_mutex_unlock(&lut_pool.lock);
+
+	st = &lut_pool.stripe[0];
+	lut_run(st->d16, st->d, st->s, st->size, st->fmt, st->h);
+
+	pthread_mutex_lock(&lut_pool.lock);
+	while(lut_pool.left)
+		pthread_cond_wait(&lut_pool.done, &lut_pool.lock);
+	pthread_mutex_unlock(&lut_pool.lock);
+
+	pthread_mutex_unlock(&lut_pool.busy);
+}
+
+void cam4_rd_do_LUT(
+       uint16_t        *raw16,
+       void            *img,
+       uint32_t        fsize
+)
+{
+	cam4_lut_table_t	*h = cam4_lut_hold(fsize >> 28);
+
+	lut_run(raw16, img, img, fsize & 0xfffffff, fsize >> 28, h);
+	cam4_lut_drop(h);
+}
+
+void cam4_rd_LUT_frame(
+	uint16_t	*raw16,
+	uint8_t		*dst,
+	const void	*src,
+	uint32_t	fsize,
+	uint32_t	osize
+)
+{
+	unsigned		fmt = CAM4_LUT_FMT(fsize, osize);
+	cam4_lut_table_t	*h = cam4_lut_hold(fmt);
+
+	lut_frame(raw16, dst, src, fsize & 0xfffffff, fmt, h);
+	cam4_lut_drop(h);
+}
+
+unsigned cam4_lut_group(unsigned fmt, unsigned *pixels)
+{
+	switch(fmt & 7) {
+	    case 0:	*pixels = 1;	return 1;	/* 8 */
+	    case 1:	*pixels = 16;	return 20;	/* 10: 5 words */
+	    case 2:	*pixels = 8;	return 12;	/* 12: 3 words */
+	    case 3:	*pixels = 16;	return 28;	/* 14: 7 words */
+	    case 4:	*pixels = 1;	return 2;	/* 16 */
+	}
+
+	*pixels = 0;
+	return 0;
+}
+
+void cam4_rd_LUT_span(
+	uint8_t		*dst,
+	const void	*src,
+	uint32_t	size,
+	unsigned	fmt,
+	const cam4_lut_table_t *h
+)
+{
+	lut_run(NULL, dst, src, size, fmt, h);
+}
+
+const char *cam4_lut_kernel(void)
+{
+	pthread_once(&lut_probe_once, lut_probe);
+	return lut_simd->name;
+}
+
+#ifdef ELEMENTARY_TEST
+#include <stdlib.h>
+
+/*
+ * The stream read bit by bit: field k is bits [k * bits, (k + 1) * bits),
+ * the sample its low 8 + 2 * depth bits
+ */
+static void ref_run(uint16_t *d16, uint8_t *d, const uint8_t *s, size_t size, unsigned fmt)
+{
+	unsigned		field = fmt & 7, depth = fmt >> 4 ? fmt >> 4 : field;
+	const lut_depth_t	*l = lut_depth(depth);
+	const cam4_lut_curve_t	*c = field ? &l->tone.seg : NULL;
+	unsigned		bits = 8 + 2 * field, group, gpix, b;
+	size_t			k, pix, v;
+	lut_tone_t		e;
+
+	group	= cam4_lut_group(fmt, &gpix);
+	pix	= size / group * gpix;
+	if(c && l->tone.shape == CAM4_LUT_GAMMA)
+		lut_tone_init(&e, &l->tone, l->bits);
+
+	for(k = 0; k < pix; k++) {
+		for(v = 0, b = 0; b < bits; b++)
+			v = v << 1 | (s[(k * bits + b) / 8] >> (7 - (k * bits + b) % 8) & 1);
+		if(c)
+			v &= (1u << l->bits) - 1;
+		d16[k]	= v;
+		if(!c)
+			d[k] = v;
+		else if(l->tone.shape == CAM4_LUT_GAMMA)
+			d[k] = lut_tone(&e, v);
+		else
+			d[k] = lut(v >> l->scale, c->s[0], c->s[1], c->s[2], c->th[0], c->th[1], c->th[2],
+			    c->shift[0], c->shift[1], c->shift[2]);
+	}
+}
+
+static int check(const char *what, unsigned fmt, size_t size, const void *a, const void *b, size_t n)
+{
+	if(!memcmp(a, b, n))
+		return 0;
+
+	printf("%s: %s fmt %#x size %zu: MISMATCH\n", what, lut_simd->name, fmt, size);
+	return 1;
+}
+
+/*
+ * A new curve leaves a held table alone; black and white end the gamma
+ * curve.  With every table held the curve gives up instead of waiting.
+ */
+static unsigned check_swap(void)
+{
+	static uint8_t		keep[1 << 16];
+	cam4_lut_table_t	*h1, *h2, *h3;
+	unsigned		err = 0, i;
+
+	cam4_lut_command("12 GAMMA 100 3000 2.2");
+	h1 = cam4_lut_hold(2);
+	memcpy(keep, h1->table, 1 << 12);
+
+	cam4_lut_command("12 GAMMA 200 4000 1.8 0.6 0.8 LOG");
+	h2 = cam4_lut_hold(2);
+	err += h1 == h2 || memcmp(keep, h1->table, 1 << 12);
+	err += h1->table[100] != 0 || h1->table[3000] != 255;
+	err += h2->table[200] != 0 || h2->table[4000] != 255 || h2->table[199] != 0;
+	for(i = 1; i < 1 << 12; i++)
+		err += h2->table[i] < h2->table[i - 1];
+
+	err += !!cam4_lut_command("12 DEFAULT");
+	h3 = cam4_lut_hold(2);
+	err += cam4_lut_command("12 GAMMA 100 3000 2.2") != -2;
+	err += cam4_lut_hold(2) != h3;
+	cam4_lut_drop(h3);
+
+	cam4_lut_drop(h1);
+	err += !!cam4_lut_command("12 DEFAULT");
+	cam4_lut_drop(h2);
+	cam4_lut_drop(h3);
+	if(err)
+		printf("curve swap: %u errors\n", err);
+
+	return err;
+}
+
+/* every kernel this CPU runs against the scalar converters and the bit reader */
+int main(int argc, char **argv)
+{
+	static const lut_simd_t	*simd[3];
+	static const size_t	sizes[] = { 0, 1, 20, 24, 28, 40, 56, 60, 84, 100, 120, 1000, 4096, 40960, 65536 + 120 };
+	/* every field, then the 16 bit containers and a 12 bit field of 10 bit samples */
+	static const unsigned	layout[] = { 0, 1, 2, 3, 4, 0x14, 0x24, 0x34, 0x12 };
+	static const cam4_lut_curve_t	curve = { { 37, 9, 2 }, { 300, 2000, 0 }, { 0, 2700, 9000 } };
+	static const char	*tone[] = { NULL, "10 GAMMA 64 1000 2.2 0.7 0.9 LOG",
+		"12 GAMMA 0 0 0.45", "14 GAMMA 800 15000 2.4 0.5 0.75 LIN", "16 GAMMA 256 60000 1.8 0.4 0.7 LOG" };
+	cam4_lut_table_t	*h;
+	const size_t		max = 65536 + 120 + 64;
+	uint8_t			*src = malloc(max + 4), *ip = malloc(max + 4);
+	uint8_t			*d_ref = malloc(max), *d_s = malloc(max), *d_v = malloc(max);
+	uint16_t		*w_ref = malloc(max * 2), *w_s = malloc(max * 2), *w_v = malloc(max * 2);
+	unsigned		nsimd = 0, fmt, j, i, k, pass, off, gpix, group, err = 0;
+	size_t			size, pix, z;
+	uint8_t			guard[32];
+
+	lut_probe();
+	simd[nsimd++] = lut_simd;
+#if defined(__x86_64__) || defined(__i386__)
+	if(lut_simd == &lut_avx2)
+		simd[nsimd++] = &lut_ssse3;
+#endif
+
+	memset(guard, 0xa5, sizeof(guard));
+	srand(1);
+	for(z = 0; z < max + 4; z++)
+		src[z] = rand();
+
+	for(pass = 0; pass < 3; pass++) {
+		for(fmt = 1; fmt < 5; fmt++)
+			if(pass == 1)
+				cam4_lut_set_curve(fmt, &curve);
+			else if(pass == 2)
+				err += !!cam4_lut_command(tone[fmt]);
+
+		for(j = 0; j < sizeof(layout) / sizeof(layout[0]); j++) {
+			fmt	= layout[j];
+			group	= cam4_lut_group(fmt, &gpix);
+
+			for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			for(off = 0; off < 4; off++) {
+				size	= sizes[i] / group * group;
+				pix	= size / group * gpix;
+				h	= cam4_lut_hold(fmt);
+
+				lut_simd = &lut_scalar;
+				ref_run(w_ref, d_ref, src + off, size, fmt);
+				lut_run(w_s, d_s, src + off, size, fmt, h);
+				err += check("scalar", fmt, size, w_ref, w_s, pix * 2);
+				err += check("scalar", fmt, size, d_ref, d_s, pix);
+
+				for(k = 0; k < nsimd; k++) {
+					lut_simd = simd[k];
+
+					memset(w_v, 0xa5, max * 2);
+					memset(d_v, 0xa5, max);
+					lut_run(w_v, d_v, src + off, size, fmt, h);
+					err += check("16 bit", fmt, size, w_ref, w_v, pix * 2);
+					err += check("8 bit", fmt, size, d_ref, d_v, pix);
+					err += check("16 bit guard", fmt, size, guard, w_v + pix, sizeof(guard));
+					err += check("8 bit guard", fmt, size, guard, d_v + pix, sizeof(guard));
+
+					lut_run(NULL, d_v, src + off, size, fmt, h);
+					err += check("8 bit only", fmt, size, d_ref, d_v, pix);
+
+					memcpy(ip, src + off, size);
+					lut_run(w_v, ip, ip, size, fmt, h);
+					err += check("in place", fmt, size, d_ref, ip, pix);
+				}
+				cam4_lut_drop(h);
+			}
+		}
+	}
+
+	/* stripes against one run, a cut group at the end */
+	lut_simd = simd[0];
+	size = (1 << 20) + 13;
+	free(src);
+	src = malloc(size);
+	for(z = 0; z < size; z++)
+		src[z] = rand();
+	w_s = realloc(w_s, size * 2);
+	w_v = realloc(w_v, size * 2);
+	d_s = realloc(d_s, size);
+	d_v = realloc(d_v, size);
+	cam4_lut_threads(5);
+
+	for(j = 0; j < sizeof(layout) / sizeof(layout[0]); j++) {
+		fmt	= layout[j];
+		group	= cam4_lut_group(fmt, &gpix);
+		pix	= size / group * gpix;
+
+		h = cam4_lut_hold(fmt);
+		lut_run(w_s, d_s, src, size, fmt, h);
+		lut_frame(w_v, d_v, src, size, fmt, h);
+		cam4_lut_drop(h);
+		err += check("striped 16 bit", fmt, size, w_s, w_v, pix * 2);
+		err += check("striped 8 bit", fmt, size, d_s, d_v, pix);
+	}
+
+	err += check_swap();
+
+	printf("cam4_ps-lut: %s kernel%s, stripes and curves checked, %u mismatches\n",
+	    nsimd > 1 ? "avx2 and ssse3" : lut_simd->name, nsimd > 1 ? "s" : "", err);
+
+	return err ? 1 : 0;
+}
+#endif
@@ -28,10 +28,115 @@
 
 #include <unistd.h>
 #include <inttypes.h>
+/*
+ * Piecewise linear curve of the 8 bit conversion, for a sample v in
+ * section k (v < th[0], v < th[1], any other):
+ *	(s[k] * v + shift[k]) >> 4
+ * 14 bit samples come to the curve as v >> 2.
+ */
+typedef struct cam4_lut_curve_s {
+	uint16_t	s[3];
+	uint16_t	th[3];
+	uint16_t	shift[3];
+} cam4_lut_curve_t;
+
+/*
+ * Tone curve of a sample depth.  CAM4_LUT_SEG is the piecewise linear
+ * curve above.  CAM4_LUT_GAMMA maps samples black..white (0 - full scale)
+ * to x of 0..1, the pixel is 255 * y:
+ *	y = knee_y * (x / knee_x)^(1 / gamma)		x < knee_x
+ * then a line to 1, or with log a log shoulder going on with the slope
+ * of the gamma segment.  knee_x = knee_y = 1 - no knee.
+ */
+enum {
+	CAM4_LUT_SEG,
+	CAM4_LUT_GAMMA,
+};
+
+typedef struct cam4_lut_tone_s {
+	unsigned		shape;
+	cam4_lut_curve_t	seg;		/* CAM4_LUT_SEG */
+	unsigned		black;
+	unsigned		white;
+	float			gamma;
+	float			knee_x;
+	float			knee_y;
+	unsigned		log;
+} cam4_lut_tone_t;
+
+/*
+ * Curve of the samples of fmt bits (as fsize[31:28]), from the next frame
+ * on.  The caller waits while two frames still hold older tables, a
+ * second at most.  -1 - the format has no LUT or the curve is not valid,
+ * -2 - the tables stayed held, the curve is not changed.
+ */
+extern int cam4_lut_set_tone(unsigned fmt, const cam4_lut_tone_t *tone);
+extern int cam4_lut_set_curve(unsigned fmt, const cam4_lut_curve_t *curve);
+
+/* FIFO CURVE: argument, -1 - not understood, -2 - as cam4_lut_set_tone() */
+extern int cam4_lut_command(const char *cmd);
+
+/*
+ * Sample layout of a frame for the LUT: the packed fields fsize[31:28]
+ * and the sensor bits osize[31:28].  A sensor of fewer bits than the
+ * field (0 - as many) has its samples in the low bits of each field,
+ * the curve of the sensor bits applies.
+ */
+#define CAM4_LUT_FMT(fsize, osize)	((fsize) >> 28 | ((osize) >> 28 & 7) << 4)
+
+/*
+ * Table of a sample layout pinned for a frame: a new curve does not touch
+ * it until it is dropped.  NULL - 8 bit samples, no table.
+ */
+typedef struct cam4_lut_table_s cam4_lut_table_t;
+
+extern cam4_lut_table_t *cam4_lut_hold(unsigned fmt);
+extern void cam4_lut_drop(cam4_lut_table_t *t);
+
 extern void cam4_rd_do_LUT(
        uint16_t        *raw16,
        void            *img,
        uint32_t        fsize
 );
 
+/*
+ * cam4_rd_do_LUT() out of place, osize gives the sensor bits: the packed
+ * frame at src is left intact
+ */
+extern void cam4_rd_LUT_frame(
+	uint16_t	*raw16,
+	uint8_t		*dst,
+	const void	*src,
+	uint32_t	fsize,
+	uint32_t	osize
+);
+
+/*
+ * Packed sample group of format fmt (fsize[31:28]): bytes returned,
+ * pixels they hold in *pixels.  0 - the format has no LUT.
+ */
+extern unsigned cam4_lut_group(unsigned fmt, unsigned *pixels);
+
+/*
+ * Out of place LUT: size bytes of packed samples of layout fmt
+ * (CAM4_LUT_FMT) at src to 8 bit pixels at dst through the table held
+ * for fmt, no 16 bit copy.  size is whole groups, src need not be aligned.
+ */
+extern void cam4_rd_LUT_span(
+	uint8_t		*dst,
+	const void	*src,
+	uint32_t	size,
+	unsigned	fmt,
+	const cam4_lut_table_t *t
+);
+
+/*
+ * cam4_rd_LUT_frame() in stripes over n threads, the caller's one of
+ * them (default 1).  Helpers are only ever added.  -1 - a thread failed.
+ */
+extern int cam4_lut_threads(unsigned n);
+
+/* unpack kernel picked for this CPU: "avx2", "ssse3" or "scalar" */
+extern const char *cam4_lut_kernel(void);
+
 #endif
@@ -0,0 +1,346 @@
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#define TRACE_PRIVATE_PREFIX    1
+#include <trace.h>
+
+#include <net/cap-files.h>
+
+#include "cam4_ps-pcap.h"
+
+static char* trace_prefix = "PCAP:\t";
+
+/* queue entries, enough for the packets of every ring entry in flight */
+#define PCAP_QUEUE	65536
+/* entries per writev(): record + payload each, IOV_MAX is 1024 */
+#define PCAP_BATCH	512
+#define PCAP_SNAPLEN	65535
+
+/* pcap record header and the fake Ethernet header, written as one piece */
+typedef struct {
+	tcpdump_packet_header_t	ph;
+	uint8_t			dst[6];
+	uint8_t			src[6];
+	uint16_t		type;
+} __attribute__((packed)) pcap_record_t;
+
+typedef struct {
+	pcap_record_t	rec;
+	void		*data;		/* NULL - release only */
+	unsigned	len;
+	void		*release;
+} pcap_entry_t;
+
+struct pcap_arch_s {
+	char		*path;
+	uint64_t	rotate;		/* bytes per file */
+	pcap_release_f	release;
+
+	int		fd;
+	unsigned	file_nr;
+	uint64_t	file_bytes;
+
+	/* single producer: capture thread, single consumer: writer */
+	pcap_entry_t	*q;
+	volatile unsigned	head;
+	volatile unsigned	tail;
+	volatile unsigned	queued_rel;	/* producer side */
+	volatile unsigned	done_rel;	/* writer side */
+
+	volatile int	run;
+	pthread_t	thread;
+
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	drops;		/* queue full, producer side */
+	uint64_t	lost;		/* write failed, writer side */
+	int		write_err;
+};
+
+/* start the next file of the set */
+static int pcap_arch_rotate(pcap_arch_t *pa)
+{
+	tcpdump_file_header_t	fh = {
+		.magic		= TCPDUMP_MAGIC,
+		.version_major	= 2,
+		.version_minor	= 4,
+		.snaplen	= PCAP_SNAPLEN,
+		.linktype	= TCPDUMP_LINKTYPE_ETHERNET,
+	};
+	char			name[PATH_MAX];
+
+	if(pa->fd >= 0)
+		close(pa->fd);
+
+	snprintf(name, sizeof(name), "%s.%03u", pa->path, pa->file_nr++);
+
+	pa->fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(pa->fd < 0) {
+		ETRACEP("Cannot create %s. errno ", name);
+		return -1;
+	}
+
+	if(write(pa->fd, &fh, sizeof(fh)) != sizeof(fh)) {
+		ETRACEP("Cannot write %s. errno ", name);
+		close(pa->fd);
+		pa->fd = -1;
+		return -1;
+	}
+
+	pa->file_bytes = sizeof(fh);
+	TRACEPNF(1, "%s\n", name);
+	return 0;
+}
+
+/* the whole iovec or an error; iov is consumed */
+static int pcap_arch_writev(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t		res;
+
+	while(cnt) {
+		res = writev(fd, iov, cnt);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while(cnt && res >= iov->iov_len) {
+			res -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if(cnt) {
+			iov->iov_base	= (uint8_t *)iov->iov_base + res;
+			iov->iov_len	-= res;
+		}
+	}
+
+	return 0;
+}
+
+/* write out one batch of the queue, then release its ring entries */
+static unsigned pcap_arch_batch(pcap_arch_t *pa)
+{
+	struct iovec	iov[PCAP_BATCH * 2];
+	unsigned	head, tail, n, i, cnt = 0;
+	uint64_t	bytes = 0, packets = 0;
+
+	head	= pa->head;
+	tail	= pa->tail;
+	__sync_synchronize();
+
+	n = head - tail;
+	if(n > PCAP_BATCH)
+		n = PCAP_BATCH;
+	if(!n)
+		return 0;
+
+	for(i = 0; i < n; i++) {
+		pcap_entry_t	*e = &pa->q[(tail + i) & (PCAP_QUEUE - 1)];
+
+		if(!e->data)
+			continue;
+
+		iov[cnt].iov_base	= &e->rec;
+		iov[cnt].iov_len	= sizeof(e->rec);
+		iov[cnt + 1].iov_base	= e->data;
+		iov[cnt + 1].iov_len	= e->len;
+		cnt	+= 2;
+		bytes	+= sizeof(e->rec) + e->len;
+		packets++;
+	}
+
+	if(cnt && (pa->fd < 0 || pa->file_bytes >= pa->rotate) && !pa->write_err)
+		pa->write_err = pcap_arch_rotate(pa);
+
+	if(cnt && !pa->write_err) {
+		if(pcap_arch_writev(pa->fd, iov, cnt)) {
+			ETRACEP("Archive write failed, archiving stopped. errno ");
+			pa->write_err = 1;
+		} else {
+			pa->file_bytes	+= bytes;
+			pa->bytes	+= bytes;
+			pa->packets	+= packets;
+		}
+	}
+
+	if(cnt && pa->write_err)
+		pa->lost += packets;
+
+	/* ring entries of the written packets go back to the kernel */
+	__sync_synchronize();
+	for(i = 0; i < n; i++) {
+		pcap_entry_t	*e = &pa->q[(tail + i) & (PCAP_QUEUE - 1)];
+
+		if(e->release) {
+			pa->release(e->release);
+			pa->done_rel++;
+		}
+	}
+
+	__sync_synchronize();
+	pa->tail = tail + n;
+	return n;
+}
+
+static void *pcap_arch_thread(void *priv)
+{
+	pcap_arch_t	*pa = priv;
+
+	while(pa->run || pa->head != pa->tail)
+		if(!pcap_arch_batch(pa))
+			usleep(1000);
+
+	return NULL;
+}
+
+pcap_arch_t *pcap_arch_open(const char *path, unsigned rotate_mb, pcap_release_f release)
+{
+	pcap_arch_t	*pa;
+
+	pa = calloc(1, sizeof(*pa));
+	if(!pa)
+		return NULL;
+
+	pa->fd		= -1;
+	pa->rotate	= (uint64_t)(rotate_mb ? rotate_mb : 1) << 20;
+	pa->release	= release;
+	pa->path	= strdup(path);
+	pa->q		= calloc(PCAP_QUEUE, sizeof(*pa->q));
+
+	if(!pa->path || !pa->q) {
+		ETRACEP("Cannot allocate archive queue. errno ");
+		goto err;
+	}
+
+	/* the first file now: a bad path should fail at start */
+	if(pcap_arch_rotate(pa))
+		goto err;
+
+	pa->run = 1;
+	if(pthread_create(&pa->thread, NULL, pcap_arch_thread, pa)) {
+		ETRACEP("Cannot start archive writer. errno ");
+		goto err;
+	}
+
+	TRACEPNF(0, "%s.NNN, %u MB per file\n", path, (unsigned)(pa->rotate >> 20));
+	return pa;
+err:
+	if(pa->fd >= 0)
+		close(pa->fd);
+	free(pa->q);
+	free(pa->path);
+	free(pa);
+	return NULL;
+}
+
+unsigned pcap_arch_room(pcap_arch_t *pa)
+{
+	return PCAP_QUEUE - (pa->head - pa->tail);
+}
+
+unsigned pcap_arch_held(pcap_arch_t *pa)
+{
+	return pa->queued_rel - pa->done_rel;
+}
+
+void pcap_arch_packet(pcap_arch_t *pa, void *ip, unsigned caplen, unsigned len,
+	uint32_t sec, uint32_t usec, const uint8_t *src_mac, void *release)
+{
+	pcap_entry_t	*e = &pa->q[pa->head & (PCAP_QUEUE - 1)];
+
+	e->data		= ip;
+	e->len		= caplen;
+	e->release	= release;
+
+	if(ip) {
+		e->rec.ph.header_own.tv_last.tv_sec	= sec;
+		e->rec.ph.header_own.tv_last.tv_usec	= usec;
+		e->rec.ph.header_own.len		= caplen + 14;
+		e->rec.ph.len				= len + 14;
+
+		memset(e->rec.dst, 0, sizeof(e->rec.dst));
+		if(src_mac)
+			memcpy(e->rec.src, src_mac, sizeof(e->rec.src));
+		else
+			memset(e->rec.src, 0, sizeof(e->rec.src));
+		e->rec.type = htons(0x0800);
+	}
+
+	if(release)
+		pa->queued_rel++;
+
+	__sync_synchronize();
+	pa->head++;
+}
+
+void pcap_arch_drop(pcap_arch_t *pa, unsigned packets)
+{
+	pa->drops += packets;
+}
+
+void pcap_arch_flush(pcap_arch_t *pa)
+{
+	while(pa->head != pa->tail)
+		usleep(1000);
+}
+
+void pcap_arch_stats(pcap_arch_t *pa, uint64_t *packets, uint64_t *bytes, uint64_t *drops)
+{
+	*packets	= pa->packets;
+	*bytes		= pa->bytes;
+	*drops		= pa->drops + pa->lost;
+}
+
+void pcap_arch_close(pcap_arch_t *pa)
+{
+	if(!pa)
+		return;
+
+	pa->run = 0;
+	pthread_join(pa->thread, NULL);
+
+	TRACE(0, "archive: %"PRIu64" packets, %"PRIu64" bytes in %u files, %"PRIu64" not archived\n",
+		pa->packets, pa->bytes, pa->file_nr, pa->drops + pa->lost);
+
+	if(pa->fd >= 0)
+		close(pa->fd);
+	free(pa->q);
+	free(pa->path);
+	free(pa);
+}
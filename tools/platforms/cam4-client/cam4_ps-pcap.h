@@ -0,0 +1,84 @@
+#ifndef __CAM4_PS_PCAP_H__
+#define __CAM4_PS_PCAP_H__
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <unistd.h>
+#include <inttypes.h>
+
+/*
+ * Packet archive: raw camera packets go to rotating tcpdump files from
+ * a writer thread.  The capture thread queues only the packet headers,
+ * payload is written by writev() straight from the rx ring; the ring
+ * entry is given back to the kernel by the release callback after the
+ * writer is done with it.  One archive has one producer.
+ */
+typedef struct pcap_arch_s pcap_arch_t;
+
+/* hand a ring entry (V1 frame, V3 block) back to the kernel */
+typedef void (*pcap_release_f)(void *entry);
+
+/* files are path.000, path.001, ... of rotate_mb megabytes each */
+extern pcap_arch_t *pcap_arch_open(
+	const char	*path,
+	unsigned	rotate_mb,
+	pcap_release_f	release
+);
+
+/* free queue entries */
+extern unsigned pcap_arch_room(pcap_arch_t *pa);
+
+/* ring entries queued and not yet released */
+extern unsigned pcap_arch_held(pcap_arch_t *pa);
+
+/*
+ * Queue one IP packet, it gets a fake Ethernet header from src_mac (may
+ * be NULL).  A non-NULL release is called for the ring entry after this
+ * packet is written; ip == NULL queues only the release.
+ */
+extern void pcap_arch_packet(
+	pcap_arch_t	*pa,
+	void		*ip,
+	unsigned	caplen,
+	unsigned	len,
+	uint32_t	sec,
+	uint32_t	usec,
+	const uint8_t	*src_mac,
+	void		*release
+);
+
+/* packets not archived for lack of queue room */
+extern void pcap_arch_drop(pcap_arch_t *pa, unsigned packets);
+
+/* wait until everything queued is written and released */
+extern void pcap_arch_flush(pcap_arch_t *pa);
+
+extern void pcap_arch_stats(pcap_arch_t *pa, uint64_t *packets, uint64_t *bytes, uint64_t *drops);
+
+/* flushes, stops the writer */
+extern void pcap_arch_close(pcap_arch_t *pa);
+
+#endif
@@ -0,0 +1,345 @@
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/sock_diag.h>
+
+#define TRACE_PRIVATE_PREFIX    1
+#include <trace.h>
+
+#include "cam4_ps-uring.h"
+
+static char* trace_prefix = "URING:\t";
+
+/* the only buffer group we register */
+#define URING_BGID	0
+
+struct uring_sock_s {
+	int		fd;		/* io_uring */
+	int		sock;
+
+	/* submission queue */
+	void		*sq_map;
+	size_t		sq_map_len;
+	unsigned	*sq_tail;
+	unsigned	*sq_mask;
+	unsigned	*sq_array;
+	struct io_uring_sqe	*sqes;
+	size_t		sqes_len;
+
+	/* completion queue */
+	void		*cq_map;
+	size_t		cq_map_len;
+	unsigned	*cq_head;
+	unsigned	*cq_tail;
+	unsigned	*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	/* provided buffers */
+	struct io_uring_buf_ring	*br;
+	size_t		br_len;
+	uint8_t		*bufs;
+	unsigned	nbufs;
+	unsigned	buf_size;
+
+	struct msghdr		msg;
+
+	uint64_t	packets;
+	uint64_t	truncated;
+	uint64_t	rearms;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned op, void *arg, unsigned nr)
+{
+	return syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/* queue buffer bid at tail + i, published by the caller */
+static inline void uring_buf_add(uring_sock_t *us, unsigned bid, unsigned i)
+{
+	struct io_uring_buf	*b = &us->br->bufs[(us->br->tail + i) & (us->nbufs - 1)];
+
+	b->addr	= (uintptr_t)(us->bufs + (size_t)bid * us->buf_size);
+	b->len	= us->buf_size;
+	b->bid	= bid;
+}
+
+/* (re)arm the multishot receive, the only syscall on the data path */
+static int uring_arm(uring_sock_t *us)
+{
+	unsigned		tail = *us->sq_tail;
+	unsigned		idx  = tail & *us->sq_mask;
+	struct io_uring_sqe	*sqe = &us->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode	= IORING_OP_RECVMSG;
+	sqe->fd		= us->sock;
+	sqe->addr	= (uintptr_t)&us->msg;
+	sqe->len	= 1;
+	sqe->ioprio	= IORING_RECV_MULTISHOT;
+	sqe->flags	= IOSQE_BUFFER_SELECT;
+	sqe->buf_group	= URING_BGID;
+
+	us->sq_array[idx] = idx;
+	__atomic_store_n(us->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if(sys_io_uring_enter(us->fd, 1, 0, 0) != 1) {
+		ETRACEP("Cannot submit multishot recvmsg. errno ");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int uring_rings_map(uring_sock_t *us, struct io_uring_params *p)
+{
+	us->sq_map_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	us->cq_map_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+
+	if(p->features & IORING_FEAT_SINGLE_MMAP) {
+		if(us->cq_map_len > us->sq_map_len)
+			us->sq_map_len = us->cq_map_len;
+		us->cq_map_len = 0;
+	}
+
+	us->sq_map = mmap(NULL, us->sq_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, us->fd, IORING_OFF_SQ_RING);
+	if(us->sq_map == MAP_FAILED) {
+		us->sq_map = NULL;
+		return -1;
+	}
+
+	if(us->cq_map_len) {
+		us->cq_map = mmap(NULL, us->cq_map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, us->fd, IORING_OFF_CQ_RING);
+		if(us->cq_map == MAP_FAILED) {
+			us->cq_map = NULL;
+			return -1;
+		}
+	}
+
+	us->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+	us->sqes = mmap(NULL, us->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, us->fd, IORING_OFF_SQES);
+	if(us->sqes == MAP_FAILED) {
+		us->sqes = NULL;
+		return -1;
+	}
+
+	uint8_t	*sq = us->sq_map;
+	uint8_t	*cq = us->cq_map ? us->cq_map : us->sq_map;
+
+	us->sq_tail	= (unsigned *)(sq + p->sq_off.tail);
+	us->sq_mask	= (unsigned *)(sq + p->sq_off.ring_mask);
+	us->sq_array	= (unsigned *)(sq + p->sq_off.array);
+	us->cq_head	= (unsigned *)(cq + p->cq_off.head);
+	us->cq_tail	= (unsigned *)(cq + p->cq_off.tail);
+	us->cq_mask	= (unsigned *)(cq + p->cq_off.ring_mask);
+	us->cqes	= (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+	return 0;
+}
+
+uring_sock_t *uring_sock_open(int sock, unsigned bufs, unsigned buf_size)
+{
+	struct io_uring_params	p;
+	struct io_uring_buf_reg	reg;
+	uring_sock_t		*us;
+	unsigned		n;
+
+	/* buffer ring is power of two sized, 32768 entries at most */
+	for(n = 1; n < bufs && n < 32768; n <<= 1)
+		;
+
+	us = calloc(1, sizeof(*us));
+	if(!us) {
+		close(sock);
+		return NULL;
+	}
+
+	us->fd		= -1;
+	us->sock	= sock;
+	us->nbufs	= n;
+	us->buf_size	= buf_size;
+
+	/* the CQ must hold a completion for every buffer */
+	memset(&p, 0, sizeof(p));
+	p.flags		= IORING_SETUP_CQSIZE;
+	p.cq_entries	= 2 * n;
+	us->fd = sys_io_uring_setup(8, &p);
+	if(us->fd < 0) {
+		ETRACEP("Cannot set up io_uring. errno ");
+		goto err;
+	}
+
+	if(uring_rings_map(us, &p)) {
+		ETRACEP("Cannot map io_uring rings. errno ");
+		goto err;
+	}
+
+	us->br_len	= n * sizeof(struct io_uring_buf);
+	us->br		= mmap(NULL, us->br_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	us->bufs	= malloc((size_t)n * buf_size);
+	if(us->br == MAP_FAILED || !us->bufs) {
+		if(us->br == MAP_FAILED)
+			us->br = NULL;
+		ETRACEP("Cannot allocate %u buffers of %u. errno ", n, buf_size);
+		goto err;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr		= (uintptr_t)us->br;
+	reg.ring_entries	= n;
+	reg.bgid		= URING_BGID;
+	if(sys_io_uring_register(us->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+		ETRACEP("Cannot register buffer ring. errno ");
+		goto err;
+	}
+
+	for(n = 0; n < us->nbufs; n++)
+		uring_buf_add(us, n, n);
+	__atomic_store_n(&us->br->tail, us->br->tail + us->nbufs, __ATOMIC_RELEASE);
+
+	/* every buffer starts with io_uring_recvmsg_out + the source address */
+	us->msg.msg_namelen = sizeof(struct sockaddr_in);
+
+	if(uring_arm(us))
+		goto err;
+
+	TRACEPNF(0, "multishot recvmsg: %u buffers of %u\n", us->nbufs, us->buf_size);
+	return us;
+
+err:
+	uring_sock_close(us);
+	return NULL;
+}
+
+int uring_sock_fd(uring_sock_t *us)
+{
+	return us->fd;
+}
+
+/* reap completions, pass datagrams to cb, recycle their buffers */
+unsigned uring_sock_rx(uring_sock_t *us, uring_rx_cb_t cb, void *priv)
+{
+	unsigned	head, tail, n = 0, rearm = 0;
+	unsigned	hdr = sizeof(struct io_uring_recvmsg_out) + us->msg.msg_namelen;
+
+	head = *us->cq_head;
+	tail = __atomic_load_n(us->cq_tail, __ATOMIC_ACQUIRE);
+
+	for(; head != tail; head++) {
+		struct io_uring_cqe	*cqe = &us->cqes[head & *us->cq_mask];
+
+		if(!(cqe->flags & IORING_CQE_F_MORE))
+			rearm = 1;
+
+		if(!(cqe->flags & IORING_CQE_F_BUFFER))
+			continue;	/* -ENOBUFS etc, rearmed below */
+
+		unsigned			bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		uint8_t				*buf = us->bufs + (size_t)bid * us->buf_size;
+		struct io_uring_recvmsg_out	*out = (struct io_uring_recvmsg_out *)buf;
+
+		if(cqe->res >= (int)hdr) {
+			if(out->flags & MSG_TRUNC)
+				us->truncated++;
+			else
+				cb(priv, (struct sockaddr_in *)(buf + sizeof(*out)), buf + hdr, out->payloadlen);
+		}
+
+		uring_buf_add(us, bid, n++);
+	}
+
+	__atomic_store_n(us->cq_head, head, __ATOMIC_RELEASE);
+
+	if(n) {
+		us->packets += n;
+		__atomic_store_n(&us->br->tail, us->br->tail + n, __ATOMIC_RELEASE);
+	}
+
+	if(rearm) {
+		us->rearms++;
+		uring_arm(us);
+	}
+
+	return n;
+}
+
+void uring_sock_stats(uring_sock_t *us, uint64_t *packets, uint64_t *drops)
+{
+	uint32_t	mem[SK_MEMINFO_VARS];
+	socklen_t	len = sizeof(mem);
+
+	*packets = us->packets;
+	if(!getsockopt(us->sock, SOL_SOCKET, SO_MEMINFO, mem, &len))
+		*drops = mem[SK_MEMINFO_DROPS];
+}
+
+void uring_sock_close(uring_sock_t *us)
+{
+	if(!us)
+		return;
+
+	if(us->packets)
+		TRACE(0, "io_uring: %"PRIu64" datagrams, %"PRIu64" truncated, %"PRIu64" rearms\n",
+			us->packets, us->truncated, us->rearms);
+
+	/* closing the ring cancels the pending receive */
+	if(us->fd >= 0)
+		close(us->fd);
+
+	if(us->sqes)
+		munmap(us->sqes, us->sqes_len);
+	if(us->cq_map)
+		munmap(us->cq_map, us->cq_map_len);
+	if(us->sq_map)
+		munmap(us->sq_map, us->sq_map_len);
+	if(us->br)
+		munmap(us->br, us->br_len);
+	free(us->bufs);
+
+	if(us->sock >= 0)
+		close(us->sock);
+	free(us);
+}
@@ -0,0 +1,62 @@
+#ifndef __CAM4_PS_URING_H__
+#define __CAM4_PS_URING_H__
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <unistd.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+
+/*
+ * io_uring receive: one multishot RECVMSG on a datagram socket, payload
+ * lands in a ring of provided buffers.  The ring fd is pollable; draining
+ * completions needs no syscall.
+ */
+typedef struct uring_sock_s uring_sock_t;
+
+typedef void (*uring_rx_cb_t)(void *priv, struct sockaddr_in *from, uint8_t *data, unsigned len);
+
+/* takes over sock, it is closed by uring_sock_close() */
+extern uring_sock_t *uring_sock_open(
+	int		sock,
+	unsigned	bufs,
+	unsigned	buf_size
+);
+
+extern int uring_sock_fd(uring_sock_t *us);
+
+extern unsigned uring_sock_rx(
+	uring_sock_t	*us,
+	uring_rx_cb_t	cb,
+	void		*priv
+);
+
+/* datagrams received, dropped by the socket for lack of buffer space */
+extern void uring_sock_stats(uring_sock_t *us, uint64_t *packets, uint64_t *drops);
+
+extern void uring_sock_close(uring_sock_t *us);
+
+#endif
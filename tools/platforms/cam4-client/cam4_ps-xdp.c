@@ -0,0 +1,442 @@
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+
+#define TRACE_PRIVATE_PREFIX    1
+#include <trace.h>
+
+#include "cam4_ps-xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP		44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP		283
+#endif
+
+static char* trace_prefix = "XDP:\t";
+
+/*
+ * UMEM chunk: one Ethernet frame after the XDP headroom, aligned mode
+ * takes 2 kB up to a page.  Larger frames would need multi-buffer.
+ */
+#define XDP_CHUNK_MIN	2048
+/* a VLAN tagged Ethernet header on top of the MTU, XDP_MTU_MAX fills a page */
+#define XDP_CHUNK_NEED(mtu)	(XDP_PACKET_HEADROOM + ETH_HLEN + 4 + (mtu))
+
+typedef struct xdp_ring_s {
+	uint32_t	*producer;
+	uint32_t	*consumer;
+	void		*ring;
+	uint32_t	mask;
+	void		*map;
+	size_t		map_len;
+} xdp_ring_t;
+
+struct xdp_sock_s {
+	int		fd;
+	int		map_fd;
+	int		prog_fd;
+	int		link_fd;
+
+	uint8_t		*umem;
+	size_t		umem_len;
+	unsigned	frames;
+	unsigned	chunk;		/* UMEM chunk size */
+
+	xdp_ring_t	rx;
+	xdp_ring_t	fq;
+	xdp_ring_t	cq;
+
+	const char	*mode;
+	uint64_t	packets;
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int xdp_ring_map(
+	xdp_sock_t		*xs,
+	xdp_ring_t		*r,
+	struct xdp_ring_offset	*off,
+	unsigned		size,
+	size_t			desc,
+	off_t			pgoff
+)
+{
+	r->map_len = off->desc + size * desc;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, xs->fd, pgoff);
+
+	if(r->map == MAP_FAILED) {
+		r->map = NULL;
+		ETRACEP("Cannot mmap ring %llx. errno ", (unsigned long long)pgoff);
+		return -1;
+	}
+
+	r->producer	= (uint32_t *)((uint8_t *)r->map + off->producer);
+	r->consumer	= (uint32_t *)((uint8_t *)r->map + off->consumer);
+	r->ring		= (uint8_t *)r->map + off->desc;
+	r->mask		= size - 1;
+	return 0;
+}
+
+/* UMEM, the three rings and bind(); zero-copy first, then copy mode */
+static int xdp_sock_setup(xdp_sock_t *xs, unsigned ifindex, unsigned queue)
+{
+	struct xdp_umem_reg	reg = {
+		.addr		= (uintptr_t)xs->umem,
+		.len		= xs->umem_len,
+		.chunk_size	= xs->chunk,
+		.headroom	= 0,
+	};
+	struct xdp_mmap_offsets	off;
+	struct sockaddr_xdp	sxdp = {
+		.sxdp_family	= AF_XDP,
+		.sxdp_ifindex	= ifindex,
+		.sxdp_queue_id	= queue,
+		.sxdp_flags	= XDP_ZEROCOPY,
+	};
+	socklen_t		len = sizeof(off);
+	unsigned		size = xs->frames, cq_size = 64, i;
+
+	if(setsockopt(xs->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) ||
+	   setsockopt(xs->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+	   setsockopt(xs->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &cq_size, sizeof(cq_size)) ||
+	   setsockopt(xs->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size))) {
+		ETRACEP("Cannot set up UMEM. errno ");
+		return -1;
+	}
+
+	if(getsockopt(xs->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len)) {
+		ETRACEP("Cannot get ring offsets. errno ");
+		return -1;
+	}
+
+	if(xdp_ring_map(xs, &xs->rx, &off.rx, size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+	   xdp_ring_map(xs, &xs->fq, &off.fr, size, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+	   xdp_ring_map(xs, &xs->cq, &off.cr, cq_size, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING))
+		return -1;
+
+	/* hand every chunk to the kernel */
+	for(i = 0; i < size; i++)
+		((uint64_t *)xs->fq.ring)[i] = (uint64_t)i * xs->chunk;
+	__atomic_store_n(xs->fq.producer, size, __ATOMIC_RELEASE);
+
+	xs->mode = "zero-copy";
+	if(bind(xs->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		sxdp.sxdp_flags = XDP_COPY;
+		xs->mode = "copy";
+		if(bind(xs->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+			ETRACEP("Cannot bind to queue %u. errno ", queue);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#define INSN(CODE, DST, SRC, OFF, IMM)	\
+	((struct bpf_insn){ .code = (CODE), .dst_reg = (DST), .src_reg = (SRC), .off = (OFF), .imm = (IMM) })
+
+/*
+ * XSKMAP with our socket at the queue index and the program that
+ * redirects camera frames into it.  The program is hand assembled to
+ * avoid a libbpf/clang dependency:
+ *
+ *	if(data + ETH_HLEN + sizeof(struct ip) > data_end) pass;
+ *	if(eth->h_proto != ETH_P_IP || ip->ip_p != 253 || ip->ip_id != 54321) pass;
+ *	if(ip->ip_off & (IP_MF | IP_OFFMASK)) pass;
+ *	return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ * A fragment of a datagram is not an FH/FD, and there is nothing to
+ * reassemble it here: it goes up the stack.
+ */
+static int xdp_prog_attach(xdp_sock_t *xs, unsigned ifindex, unsigned queue)
+{
+	union bpf_attr		attr;
+	uint32_t		key = queue, val = xs->fd;
+	char			log[4096] = "";
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type		= BPF_MAP_TYPE_XSKMAP;
+	attr.key_size		= sizeof(key);
+	attr.value_size		= sizeof(val);
+	attr.max_entries	= queue + 1;
+	xs->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if(xs->map_fd < 0) {
+		ETRACEP("Cannot create XSKMAP. errno ");
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd	= xs->map_fd;
+	attr.key	= (uintptr_t)&key;
+	attr.value	= (uintptr_t)&val;
+	if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+		ETRACEP("Cannot put the socket into XSKMAP. errno ");
+		return -1;
+	}
+
+	struct bpf_insn		prog[] = {
+		/* 0 */ INSN(BPF_ALU64 | BPF_MOV | BPF_X,  6, 1, 0, 0),
+		/* 1 */ INSN(BPF_LDX | BPF_W | BPF_MEM,    2, 1, offsetof(struct xdp_md, data), 0),
+		/* 2 */ INSN(BPF_LDX | BPF_W | BPF_MEM,    3, 1, offsetof(struct xdp_md, data_end), 0),
+		/* 3 */ INSN(BPF_ALU64 | BPF_MOV | BPF_X,  4, 2, 0, 0),
+		/* 4 */ INSN(BPF_ALU64 | BPF_ADD | BPF_K,  4, 0, 0, ETH_HLEN + 20),
+		/* 5 */ INSN(BPF_JMP | BPF_JGT | BPF_X,    4, 3, 15, 0),
+		/* 6 */ INSN(BPF_LDX | BPF_H | BPF_MEM,    4, 2, 12, 0),		/* h_proto */
+		/* 7 */ INSN(BPF_JMP | BPF_JNE | BPF_K,    4, 0, 13, htons(ETH_P_IP)),
+		/* 8 */ INSN(BPF_LDX | BPF_B | BPF_MEM,    4, 2, ETH_HLEN + 9, 0),	/* ip_p */
+		/* 9 */ INSN(BPF_JMP | BPF_JNE | BPF_K,    4, 0, 11, 253),
+		/* 10 */ INSN(BPF_LDX | BPF_H | BPF_MEM,   4, 2, ETH_HLEN + 4, 0),	/* ip_id */
+		/* 11 */ INSN(BPF_JMP | BPF_JNE | BPF_K,   4, 0, 9, htons(54321)),
+		/* 12 */ INSN(BPF_LDX | BPF_H | BPF_MEM,   4, 2, ETH_HLEN + 6, 0),	/* ip_off */
+		/* 13 */ INSN(BPF_ALU64 | BPF_AND | BPF_K, 4, 0, 0, htons(IP_MF | IP_OFFMASK)),
+		/* 14 */ INSN(BPF_JMP | BPF_JNE | BPF_K,   4, 0, 6, 0),
+		/* 15 */ INSN(BPF_LDX | BPF_W | BPF_MEM,   2, 6, offsetof(struct xdp_md, rx_queue_index), 0),
+		/* 16 */ INSN(BPF_LD | BPF_DW | BPF_IMM,   1, BPF_PSEUDO_MAP_FD, 0, xs->map_fd),
+		/* 17 */ INSN(0,                           0, 0, 0, 0),
+		/* 18 */ INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		/* 19 */ INSN(BPF_JMP | BPF_CALL,          0, 0, 0, BPF_FUNC_redirect_map),
+		/* 20 */ INSN(BPF_JMP | BPF_EXIT,          0, 0, 0, 0),
+		/* 21 */ INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		/* 22 */ INSN(BPF_JMP | BPF_EXIT,          0, 0, 0, 0),
+	};
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type	= BPF_PROG_TYPE_XDP;
+	attr.insns	= (uintptr_t)prog;
+	attr.insn_cnt	= sizeof(prog) / sizeof(prog[0]);
+	attr.license	= (uintptr_t)"GPL";
+	attr.log_buf	= (uintptr_t)log;
+	attr.log_size	= sizeof(log);
+	attr.log_level	= 1;
+	xs->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if(xs->prog_fd < 0) {
+		ETRACEP("Cannot load XDP program. errno ");
+		TRACE(0, "%s\n", log);
+		return -1;
+	}
+
+	/* driver mode when the NIC has it, generic (skb) mode otherwise */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd	= xs->prog_fd;
+	attr.link_create.target_ifindex	= ifindex;
+	attr.link_create.attach_type	= BPF_XDP;
+	attr.link_create.flags		= XDP_FLAGS_DRV_MODE;
+	xs->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if(xs->link_fd < 0) {
+		attr.link_create.flags	= XDP_FLAGS_SKB_MODE;
+		xs->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	}
+	if(xs->link_fd < 0) {
+		ETRACEP("Cannot attach XDP program to ifindex %u. errno ", ifindex);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* MTU of the interface, 0 - unknown */
+static unsigned xdp_link_mtu(const char *ifname)
+{
+	struct ifreq	ifr = { };
+	int		sock;
+	unsigned	mtu = 0;
+
+	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+	if( (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return 0;
+
+	if(!ioctl(sock, SIOCGIFMTU, &ifr))
+		mtu = ifr.ifr_mtu;
+
+	close(sock);
+	return mtu;
+}
+
+xdp_sock_t *xdp_sock_open(const char *ifname, unsigned queue, unsigned frames)
+{
+	xdp_sock_t	*xs;
+	unsigned	ifindex, n, mtu, chunk;
+
+	ifindex = if_nametoindex(ifname);
+	if(!ifindex) {
+		ETRACEP("Unknown interface %s. errno ", ifname);
+		return NULL;
+	}
+
+	/* the kernel drops a frame larger than the chunk silently */
+	mtu = xdp_link_mtu(ifname);
+	if(!mtu || mtu > XDP_MTU_MAX) {
+		TRACEPNF(0, "[err] %s: MTU %u does not fit a UMEM chunk, up to %u\n", ifname, mtu, XDP_MTU_MAX);
+		return NULL;
+	}
+
+	for(chunk = XDP_CHUNK_MIN; chunk < XDP_CHUNK_NEED(mtu); chunk <<= 1)
+		;
+
+	/* rings are power of two sized */
+	for(n = 1; n < frames; n <<= 1)
+		;
+	frames = n;
+
+	xs = calloc(1, sizeof(*xs));
+	if(!xs)
+		return NULL;
+
+	xs->fd		= -1;
+	xs->map_fd	= -1;
+	xs->prog_fd	= -1;
+	xs->link_fd	= -1;
+	xs->frames	= frames;
+	xs->chunk	= chunk;
+	xs->umem_len	= (size_t)frames * chunk;
+
+	xs->umem = mmap(NULL, xs->umem_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if(xs->umem == MAP_FAILED) {
+		xs->umem = NULL;
+		ETRACEP("Cannot allocate UMEM of %zu. errno ", xs->umem_len);
+		goto err;
+	}
+
+	xs->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if(xs->fd < 0) {
+		ETRACEP("Cannot create AF_XDP socket. errno ");
+		goto err;
+	}
+
+	if(xdp_sock_setup(xs, ifindex, queue) || xdp_prog_attach(xs, ifindex, queue))
+		goto err;
+
+	TRACEPNF(0, "%s queue %u: %u frames of %u, MTU %u, %s mode\n", ifname, queue, frames, chunk, mtu, xs->mode);
+	return xs;
+
+err:
+	xdp_sock_close(xs);
+	return NULL;
+}
+
+int xdp_sock_fd(xdp_sock_t *xs)
+{
+	return xs->fd;
+}
+
+/* pass received frames to cb and give the chunks back to the fill ring */
+unsigned xdp_sock_rx(xdp_sock_t *xs, xdp_rx_cb_t cb, void *priv)
+{
+	struct xdp_desc	*desc = xs->rx.ring;
+	uint64_t	*fill = xs->fq.ring;
+	uint32_t	prod, cons, fprod;
+	unsigned	n = 0;
+
+	prod	= __atomic_load_n(xs->rx.producer, __ATOMIC_ACQUIRE);
+	cons	= *xs->rx.consumer;
+	fprod	= *xs->fq.producer;
+
+	for(; cons != prod; cons++, n++) {
+		struct xdp_desc	*d = &desc[cons & xs->rx.mask];
+
+		cb(priv, xs->umem + d->addr, d->len);
+
+		fill[fprod++ & xs->fq.mask] = d->addr & ~(uint64_t)(xs->chunk - 1);
+	}
+
+	if(n) {
+		xs->packets += n;
+		__atomic_store_n(xs->rx.consumer, cons, __ATOMIC_RELEASE);
+		__atomic_store_n(xs->fq.producer, fprod, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+void xdp_sock_stats(xdp_sock_t *xs, uint64_t *packets, uint64_t *drops)
+{
+	struct xdp_statistics	st;
+	socklen_t		len = sizeof(st);
+
+	*packets = xs->packets;
+	if(!getsockopt(xs->fd, SOL_XDP, XDP_STATISTICS, &st, &len))
+		*drops = st.rx_dropped + st.rx_ring_full;
+}
+
+void xdp_sock_close(xdp_sock_t *xs)
+{
+	struct xdp_statistics	st;
+	socklen_t		len = sizeof(st);
+
+	if(!xs)
+		return;
+
+	if(xs->fd >= 0 && !getsockopt(xs->fd, SOL_XDP, XDP_STATISTICS, &st, &len))
+		TRACE(0, "xdp dropped %llu, rx ring full %llu, fill ring empty %llu\n",
+			(unsigned long long)st.rx_dropped,
+			(unsigned long long)st.rx_ring_full,
+			(unsigned long long)st.rx_fill_ring_empty_descs);
+
+	/* closing the link detaches the program */
+	if(xs->link_fd >= 0)
+		close(xs->link_fd);
+	if(xs->prog_fd >= 0)
+		close(xs->prog_fd);
+	if(xs->map_fd >= 0)
+		close(xs->map_fd);
+
+	if(xs->rx.map)
+		munmap(xs->rx.map, xs->rx.map_len);
+	if(xs->fq.map)
+		munmap(xs->fq.map, xs->fq.map_len);
+	if(xs->cq.map)
+		munmap(xs->cq.map, xs->cq.map_len);
+
+	if(xs->fd >= 0)
+		close(xs->fd);
+	if(xs->umem)
+		munmap(xs->umem, xs->umem_len);
+
+	free(xs);
+}
@@ -0,0 +1,64 @@
+#ifndef __CAM4_PS_XDP_H__
+#define __CAM4_PS_XDP_H__
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <unistd.h>
+#include <inttypes.h>
+
+/*
+ * AF_XDP capture: an XDP program on the interface queue redirects
+ * camera video frames (IPv4, ip_id 54321, proto 253, not fragmented)
+ * into the UMEM of the socket, everything else goes up the normal stack.
+ */
+typedef struct xdp_sock_s xdp_sock_t;
+
+/* largest link MTU a UMEM chunk of a page takes, one frame per chunk */
+#define XDP_MTU_MAX	(4096 - 256 - 14 - 4)
+
+/* pkt points to the Ethernet header inside the UMEM */
+typedef void (*xdp_rx_cb_t)(void *priv, uint8_t *pkt, unsigned len);
+
+extern xdp_sock_t *xdp_sock_open(
+	const char	*ifname,
+	unsigned	queue,
+	unsigned	frames
+);
+
+extern int xdp_sock_fd(xdp_sock_t *xs);
+
+extern unsigned xdp_sock_rx(
+	xdp_sock_t	*xs,
+	xdp_rx_cb_t	cb,
+	void		*priv
+);
+
+/* packets received, dropped by the kernel (RX ring full and others) */
+extern void xdp_sock_stats(xdp_sock_t *xs, uint64_t *packets, uint64_t *drops);
+
+extern void xdp_sock_close(xdp_sock_t *xs);
+
+#endif
@@ -24,19 +24,22 @@
  *       Component for conform portion of the system.
 \*/
 
+#define _GNU_SOURCE	/* recvmmsg() */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/types.h>
 
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>   /* The L2 protocols */
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
 
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/time.h>
-#define __USE_XOPEN
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -84,6 +87,9 @@
 #include <os-helpers/inet_macros.h>
 
 #include "cam4_ps.h"
+#include "cam4_ps-xdp.h"
+#include "cam4_ps-uring.h"
+#include "cam4_ps-pcap.h"
 
 #if 0
 static char *names[]={
@@ -130,32 +136,117 @@ struct timeval time_add(struct timeval tv1, double diff){
 	return res;
 }
 
+/* host clock in us, the time base of the packet time stamps */
+static inline uint64_t time_us(void)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000ull + now.tv_usec;
+}
+
+/* default sensor geometry: the ring is sized for it until the first FH */
+#define RING_DEFAULT_FSIZE	(1928 * 1090 * 2)
+/* smallest FD payload we expect from a camera, used to count packets */
+#define RING_FRAG_PAYLOAD	1400
+/* link speed used to derive the block retire timeout */
+#define RING_LINK_MBPS		1000
+#define RING_V3_BLOCK_SIZE	(1<<20)
+#define RING_V3_FRAME_SIZE	2048
+#define RING_V3_MIN_BLOCKS	8
+#define RING_DEFAULT_FRAMES	4
+/* V1 ring: slots sized by the interface MTU, this much memory in total */
+#define RING_V1_BYTES		(2000 * 8192)
+#define RING_JUMBO_MTU		9000
+#define FANOUT_MAX		16
+/* reassembled frames the worker may lag behind the receiver */
+#define FRAME_SLOTS_DEFAULT	4
+/* smallest frame side the quadrant statistics are taken for */
+#define QUAD_MIN		130
+/* camera streams one process reassembles (-N) */
+#define STREAMS_MAX		64
+/* UDP ingest: datagrams per recvmmsg() call and the largest datagram */
+#define UDP_BATCH		64
+#define UDP_SLOT_SIZE		(64 * 1024)
+/* io_uring provided buffers: jumbo frame + recvmsg header */
+#define URING_BUFS		1024
+#define URING_BUF_SIZE		(9 * 1024 + 512)
+
 typedef struct connection_s {
 	int		fd;
 	char		*map;
-	struct		tpacket_req req;
-	struct		iovec *ring;
+	int		version;	/* TPACKET_V1 or TPACKET_V3 */
+	struct		tpacket_req3 req;	/* V1 uses the tpacket_req head only */
+	struct		iovec *ring;	/* V1: frames, V3: blocks */
+	unsigned	cur;		/* next ring entry to look at */
+
+	unsigned	ring_frames;	/* V3: video frames to buffer, 0 - V1 */
+	uint32_t	ring_fsize;	/* V3: video frame size ring sized for */
+
+	in_addr_t	src_ip;		/* kernel filter: camera address, 0 - any */
+	int		ifindex;	/* bound interface, 0 - any */
+
+	/* UDP ingest instead of the packet socket */
+	uint16_t	udp_port;	/* 0 - packet socket */
+	struct mmsghdr	*msgs;
+	struct sockaddr_in	*from;
+	uint8_t		*slots;
+	struct ip	udp_iph;	/* addresses for the diagnostics */
+	uint64_t	udp_packets;
+	uint64_t	udp_calls;
+
+	/* AF_XDP socket instead of the packet socket */
+	char		*xdp_ifname;	/* NULL - packet socket */
+	unsigned	xdp_queue;
+	xdp_sock_t	*xdp;
+
+	/* io_uring multishot receive on the UDP socket */
+	int		use_uring;
+	uring_sock_t	*uring;
+
+	/* kernel counters; PACKET_STATISTICS reset on read, so they are summed */
+	uint64_t	rx_packets;
+	uint64_t	rx_drops;
+	uint64_t	rx_freezes;
+	uint64_t	rx_truncated;	/* cut by the ring slot */
+	unsigned	slot_need;	/* V1: largest packet seen + header */
+
+	/* raw packet archive written from the ring, packet socket only */
+	char		*pcap_path;	/* NULL - no archive */
+	unsigned	pcap_mb;	/* file rotation size */
+	pcap_arch_t	*pcap;
+
+	/* PACKET_FANOUT group, one capture thread per socket */
+	unsigned	fanout_nr;	/* sockets in the group, <2 - no fanout */
+	unsigned	fanout_idx;	/* member number, 0 - the first socket */
+	uint16_t	fanout_id;
+	pthread_mutex_t	*lock;		/* the stream table and the sockets, not the packets */
+	pthread_t	thread;
+	void		*priv;		/* cam4_rd_t fed by this socket */
+
+	/* packet being parsed: every capture thread has its own */
+	struct ip	*iph;
+	uint64_t	rx_us;
+	cam4_rd_t	*stream_last;	/* last looked up */
+	cam4_rd_t	*held;		/* -F: context whose rx_lock this thread holds */
+
+	/* -N: the streams this socket fed, looked up without the table lock */
+	cam4_rd_t	*shard[STREAMS_MAX];
+	unsigned	nshard;
+	uint64_t	stream_drops;	/* packets of streams beyond -N */
 } connection_t;
 
 connection_t conn;
+connection_t fanout_conn[FANOUT_MAX];
+pthread_mutex_t	fanout_lock = PTHREAD_MUTEX_INITIALIZER;	/* stats and the stream table */
 
 int		fd=-1;
 char		*map;
 struct		tpacket_req req;
 struct		iovec *ring;
 
-static int 	part_num = 0;
-uint32_t	offs_static = 0;
-
 FILE *I;
 
-uint8_t* shmaddr[2];
-uint8_t* shmaddr3;
-
-uint32_t shmid1 = -1;
-uint32_t shmid2 = -1;
-uint32_t shmid3 = -1;
-
 debayer_api_t default_debayer_api = {};
 
 int cam4_script_processing(cam4_rd_t* cam4_rd);
@@ -178,8 +269,6 @@ enum state_flags {
 
     g1_flag = 1<<5,			/* stream on */
     g2_flag = 1<<6,			/* stream off */
-
-    frame_done_flag = 1<<14
 };
 
 static uint8_t SENSOR[7] = "/sensor";
@@ -205,6 +294,26 @@ static void show_the_banner(void)
 		    "\n"
 		    "\t-d				IP of the client (CAM4 Raw stream -> dst IP)\n"
 		    "\n"
+		    "Capture options:\n"
+		    "\t-R				video frames to buffer in TPACKET_V3 ring (default 4, 0 - TPACKET_V1 ring)\n"
+		    "\t-F				capture sockets (and threads) in PACKET_FANOUT group, hashed by camera\n"
+		    "\t-A				accept video from any camera on any interface (default: camera address on the -d interface)\n"
+		    "\t-U				receive FH/FD over UDP on this port (raw_dummy_tx: 10000) via recvmmsg, no root needed\n"
+		    "\t-X				ifname[:queue] AF_XDP capture from one NIC queue (zero-copy, copy mode fallback);\n"
+		    "\t				 one frame per 4 kB UMEM chunk: no jumbo MTU, IP-fragmented datagrams are not received\n"
+		    "\t-I				with -U: io_uring multishot recvmsg into provided buffers instead of recvmmsg\n"
+		    "\t-B				frame slots between reassembly and processing (default 4, min 2), absorbs processing hiccups\n"
+		    "\t-N				camera streams (source address, flow id) to reassemble side by side, each with its own frame pool,\n"
+		    "\t				 counters and output: -f file.N, frame_N_*.raw, shared memory key_stream(N) (default 1, up to 64);\n"
+		    "\t				 more than 1 takes any camera on the -d interface, stream 0 is the -v camera and flow\n"
+		    "\t-z				zero the parts of a frame whose fragments never arrived\n"
+		    "\t-y				fill the parts of a frame whose fragments never arrived from the previous frame\n"
+		    "\t-L				LUT the fragments straight into 8 bit pixels while no raw output is on, no quadrant statistics\n"
+		    "\t-J				threads to LUT a frame in stripes, the worker's one of them (default 1, up to 16)\n"
+		    "\t-T				ms[:drop] hand a frame over once all of it came or ms after its FH, partial frames come\n"
+		    "\t				 with their missing pixels in common->frame_missing (-z/-y fill them) or are dropped with :drop\n"
+		    "\t-P				file[:MB] archive raw camera packets straight from the ring to file.000, file.001, ... (tcpdump format, default 1024 MB each)\n"
+		    "\n"
 		    "\t-h				this banner\n"
     );
     TRACE(0,/*"Press space to dump raw data\n"
@@ -225,6 +334,9 @@ static void show_the_banner(void)
 		"VIDEO:FINISH -- stop recording avi video\n"
 		"RAWVIDEO:START -- start recording raw video\n"
 		"RAWVIDEO:FINISH -- stop recording raw video\n"
+		"CURVE:bits GAMMA black white gamma [knee_x knee_y [LIN|LOG]] -- 8 bit tone curve of the 10..16 bit samples\n"
+		"CURVE:bits SEG s0 s1 s2 th0 th1 th2 shift0 shift1 shift2 -- piecewise linear tone curve\n"
+		"CURVE:bits DEFAULT -- the built in curve\n"
 		);
 };
 
@@ -234,11 +346,6 @@ void sigproc(int sig)
 	no_sig_exit = 0;
 }
 
-void sighand(int signo)
-{
-    return;
-}
-
 int write_raw_video(
 	cam4_rd_t	*ctx,
 	void		*src,
@@ -370,744 +477,6 @@ int write_video(cam4_rd_t* ctx, void* src, int todo) {
 
 }
 
-const int16_t coefrY=9797; // 0.299
-const int16_t coefgY= 19234; // 0.587
-const int16_t coefbY= 3735; // 0.114
-
-const int16_t coefCr= 23363;// 0.713
-const int16_t coefCb= 18481;// 0.564
-
-
-inline int16_t mul16x16s(int16_t a,int16_t b)
-{
-	return (int16_t)(((int32_t)a*b) >> 15);
-}
-
-void debayerRGB_fast_mode0(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
-{
-	int x,y;
-	int r,g,b;
-	int window_width,window_height;
-	int remain_size;
-	if(ww && wh)   // working with window in image
-	{
-	    window_width= ww-2;
-	    window_height= wh-2;
-	    remain_size= dim_x-ww;
-	    src+=(dim_x*starty+startx);
-	}
-	else
-	{
-	    window_width= dim_x-2;
-	    window_height= dim_y-2;
-	    remain_size=0;
-	}
-	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
-	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
-	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
-	uint16_t Y,Cr,Cb;
-	uint8_t *out=dst;
-
-			//for( y=1; y < dim_y - 1; y+=2 )
-			y= window_height;
-			do
-			{
-				/* green 1 */
-				r = (*left + *right)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-		    		g =  *center;			//d_RGB_y[x];
-		    		b = (*low + *high)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-
-				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-				//Cr= (uint8_t)(0.713*(r-Y) + 128);
-				Cr= (mul16x16s(r-Y,coefCr)+128);
-									/* copy data on edge */
-				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				*out++=Y;			//dst[j+1] = Y;		// Luma
-								//j += 2;
-				//for( x=1; x < dim_x - 1; x+=2 )
-				x= window_width;
-				do
-				{
-						/* green 1 */
-					r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-		    			g =  *center++;			//d_RGB_y[x];
-		    			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-					low_left++;low_right++;high_left++;high_right++;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cr= (uint8_t)(0.713*(r-Y) + 128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cr;
-					*out++=Y;
-		    				/* red */
-		    			r= *center++;							  //r =  d_RGB_y[x];
-		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cb= (uint8_t)(0.564*(b-Y) + 128);
-					Cb= (mul16x16s(b-Y,coefCb)+128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cb;
-					*out++=Y;
-
-				}
-				while(x-=2);
-				/* copy data on edge */
-				*out++=Cr;	//dst[j+1] = Y;		// Luma
-				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-						//j += 2;
-
-
-				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-				low+=(2+remain_size);high+=(2+remain_size);
-				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-				/* blue */
-		    		r= (*low_left + *low_right + *high_left + *high_right)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-		    		g= (*low + *left + *right + *high)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    		b =  *center;							//d_RGB_y[x];
-
-				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-				//Cr= (uint8_t)(0.713*(r-Y) + 128);
-				Cr= (mul16x16s(r-Y,coefCr)+128);
-
-				/* copy data on edge */
-
-				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				*out++=Y;			//dst[j+1] = Y;		// Luma
-									//j += 2;
-				//for( x=1; x < dim_x - 1; x+=2 )
-				x= window_width;
-				do
-				{
-					/* blue */
-		    			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    			b =  *center++;							//d_RGB_y[x];
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cr= (uint8_t)(0.713*(r-Y) + 128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-
-					*out++=Cr;
-					*out++=Y;
-
-		  		    /* green 2 */
-		    			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-		    			g =  *center++;		//g=d_RGB_y[x];
-		    			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-					low_left++;low_right++;high_left++;high_right++;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cb= (uint8_t)(0.564*(b-Y) + 128);
-					Cb= (mul16x16s(b-Y,coefCb)+128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cb;
-					*out++=Y;
-				}
-				while(x-=2);
-				/* copy data on edge */
-				*out++=Cr;	//dst[j+1] = Y;		// Luma
-				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-						//j += 2;
-
-				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-				low+=(2+remain_size);high+=(2+remain_size);
-				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-
-			}
-			while(y-=2);
-}
-
-#if 1
-typedef struct {
-	uint8_t		left;
-	uint8_t		center;
-	uint8_t		right;
-} __attribute__((packed)) bayer_trio_t;
-
-// SENS_BAYER_RGB_PHASE_RG1BG2	= (0x1<<0)
-void debayerRGB_ar_mode1(uint8_t *_dst, uint8_t *_src, int dim_x, int dim_y, int startx, int starty, int ww, int wh)
-{
-	int 		x, y = 0;
-	int 		r, g, b;
-	int 		window_width, window_height;
-	uint16_t 	Y, Cr, Cb;
-	uint8_t 	*out = _dst;
-	uint8_t		*cur_line = _src;
-
-	bayer_trio_t	*high, *mid, *low;
-
-	printf("XXX\n");
-
-	if(ww && wh) {  // working with window in image
-	    window_width  = ww - 2;
-	    window_height = wh - 2;
-	    cur_line += (dim_x * starty + startx);
-	} else {
-	    window_width  = dim_x - 2;
-	    window_height = dim_y - 2;
-	}
-
-	/**** main body ****/
-	do {
-		x = 0;
-
-		high = (bayer_trio_t*)cur_line;
-		mid  = high + dim_x;
-		low  = mid + dim_x;
-
-		do {
-			r = mid->center;
-			g = (high->center + mid->left   + mid->right + low->center) >> 2;
-			b = (high->left   + high->right + low->left  + low->right ) >> 2;
-
-			Y  = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
-			Cr = (mul16x16s(r-Y,coefCr) + 128);
-			//Cb = (mul16x16s(b-Y,coefCb) + 128);
-
-			*out++ = Cr;
-			*out++ = Y;
-
-			if(!x) {
-				/* copy data to edge */
-				*out++ = Cr;
-				*out++ = Y;
-			}
-			
-			high = (typeof(high))((uint8_t*)high + 1);
-			mid  = (typeof(mid))((uint8_t*)mid + 1);
-			low  = (typeof(low))((uint8_t*)low + 1);
-
-			r = (mid->left + mid->right) >> 1;
-			g = mid->center;
-			b = (high->center + low->center) >> 1;
-
-			Y = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
-			Cb= (mul16x16s(b-Y,coefCb)+128);
-			//Cr= (mul16x16s(r-Y,coefCr)+128);
-
-			*out++ = Cb;
-			*out++ = Y;
-
-			high = (typeof(high))((uint8_t*)high + 1);
-			mid  = (typeof(mid))((uint8_t*)mid + 1);
-			low  = (typeof(low))((uint8_t*)low + 1);
-
-			x += 2;
-		} while(x < window_width);
-
-		/* copy data to edge */
-		*out++ = Cb;
-		*out++ = Y;
-
-		/* advance to next line */
-
-		cur_line += dim_x;
-
-		high = (bayer_trio_t*)cur_line;
-		mid  = high + dim_x;
-		low  = mid + dim_x;
-
-		x = 0;
-
-		do {
-			r = (high->center + low->center) >> 1;
-			g = mid->center;
-			b = (mid->left + mid->right) >> 1;
-
-			Y  = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
-			Cr = (mul16x16s(r-Y,coefCr) + 128);
-			//Cb = (mul16x16s(b-Y,coefCb) + 128);
-
-			*out++ = Cr;
-			*out++ = Y;
-
-			if(!x) {
-				/* copy data to edge */
-				*out++ = Cr;
-				*out++ = Y;
-			}
-			
-			high = (typeof(high))((uint8_t*)high + 1);
-			mid  = (typeof(mid))((uint8_t*)mid + 1);
-			low  = (typeof(low))((uint8_t*)low + 1);
-
-			r = (high->left + high->right + low->left + low->right) >> 2;
-			g = (mid->left + high->center + mid->right + low->center) >> 2;
-			b = mid->center;
-
-			Y = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
-			Cb= (mul16x16s(b-Y,coefCb)+128);
-			//Cr= (mul16x16s(r-Y,coefCr)+128);
-
-			*out++ = Cb;
-			*out++ = Y;
-
-			high = (typeof(high))((uint8_t*)high + 1);
-			mid  = (typeof(mid))((uint8_t*)mid + 1);
-			low  = (typeof(low))((uint8_t*)low + 1);
-
-			x += 2;
-		} while(x < window_width);
-
-		/* copy data to edge */
-		*out++ = Cr;
-		*out++ = Y;
-
-		/* advance to next line */
-		cur_line += dim_x;
-		
-		y += 2;
-	} while(y < window_height);
-
-}
-#endif
-
-void debayerRGB_fast_mode1(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
-{
-	int x,y;
-	int r,g,b;
-	int window_width,window_height;
-	int remain_size;
-	if(ww && wh)   // working with window in image
-	{
-	    window_width= ww-2;
-	    window_height= wh-2;
-	    remain_size= dim_x-ww;
-	    src+=(dim_x*starty+startx);
-	}
-	else
-	{
-	    window_width= dim_x-2;
-	    window_height= dim_y-2;
-	    remain_size=0;
-	}
-	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
-	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
-	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
-	uint16_t Y,Cr,Cb;
-	uint8_t *out=dst;
-
-	//for( y=1; y < dim_y - 1; y+=2 )
-	y= window_height;
-	do
-	{
-			    /* red */
-		r= *center;							  //r =  d_RGB_y[x];
-		g= (*low + *left + *right + *high)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		b= (*low_left + *low_right + *high_left + *high_right)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-
-		//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-		Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-		//Cr= (uint8_t)(0.713*(r-Y) + 128);
-		Cr= (mul16x16s(r-Y,coefCr)+128);
-
-		*out++=Cr;
-		*out++=Y;
-		//for( x=1; x < dim_x - 1; x+=2 )
-		x= window_width;
-		do
-		{
-
-				/* red */
-			r= *center++;							  //r =  d_RGB_y[x];
-			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-
-			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-			//Cr= (uint8_t)(0.713*(r-Y) + 128);
-			Cr= (mul16x16s(r-Y,coefCr)+128);
-
-			*out++=Cr;
-			*out++=Y;
-
-				/* green 1 */
-			r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-			g =  *center++;			//d_RGB_y[x];
-			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-			low_left++;low_right++;high_left++;high_right++;
-			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-			//Cb= (uint8_t)(0.564*(b-Y) + 128);
-			Cb= (mul16x16s(b-Y,coefCb)+128);
-			Cr= (mul16x16s(r-Y,coefCr)+128);
-
-			*out++=Cb;
-			*out++=Y;
-
-		}
-		while(x-=2);
-		/* copy data on edge */
-		*out++=Cr;	//dst[j+1] = Y;		// Luma
-		*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				//j += 2;
-
-		left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-		low+=(2+remain_size);high+=(2+remain_size);
-		low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-
-		 /* green 2 */
-		r= (*low + *high)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-		g =  *center;		//g=d_RGB_y[x];
-		b= (*left + *right) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-
-		//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-		Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-		//Cr= (uint8_t)(0.713*(r-Y) + 128);
-		Cr= (mul16x16s(r-Y,coefCr)+128);
-
-		/* copy data on edge */
-
-		*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-		*out++=Y;			//dst[j+1] = Y;		// Luma
-							//j += 2;
-		//for( x=1; x < dim_x - 1; x+=2 )
-		x= window_width;
-		do
-		{
-
-			/* green 2 */
-			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-			g =  *center++;		//g=d_RGB_y[x];
-			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-			low_left++;low_right++;high_left++;high_right++;
-
-			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-			//Cr= (uint8_t)(0.713*(r-Y) + 128);
-			Cr= (mul16x16s(r-Y,coefCr)+128);
-
-			*out++=Cr;
-			*out++=Y;
-			/* blue */
-			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-			b =  *center++;							//d_RGB_y[x];
-
-			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-			//Cb= (uint8_t)(0.564*(b-Y) + 128);
-			Cb= (mul16x16s(b-Y,coefCb)+128);
-			Cr= (mul16x16s(r-Y,coefCr)+128);
-
-			*out++=Cb;
-			*out++=Y;
-		}
-		while(x-=2);
-		/* copy data on edge */
-		*out++=Cr;	//dst[j+1] = Y;		// Luma
-		*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				//j += 2;
-
-		left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-		low+=(2+remain_size);high+=(2+remain_size);
-		low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-
-	}
-	while(y-=2);
-}
-
-void debayerRGB_fast_mode2(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
-{
-	int x,y;
-	int r,g,b;
-	int window_width,window_height;
-	int remain_size;
-	if(ww && wh)   // working with window in image
-	{
-	    window_width= ww-2;
-	    window_height= wh-2;
-	    remain_size= dim_x-ww;
-	    src+=(dim_x*starty+startx);
-	}
-	else
-	{
-	    window_width= dim_x-2;
-	    window_height= dim_y-2;
-	    remain_size=0;
-	}
-	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
-	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
-	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
-	uint16_t Y,Cr,Cb;
-	uint8_t *out=dst;
-
-			//for( y=1; y < dim_y - 1; y+=2 )
-			y= window_height;
-			do
-			{
-				/* blue */
-		    		r= (*low_left + *low_right + *high_left + *high_right)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-		    		g= (*low + *left + *right + *high)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    		b =  *center;							//d_RGB_y[x];
-
-				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-				//Cr= (uint8_t)(0.713*(r-Y) + 128);
-				Cr= (mul16x16s(r-Y,coefCr)+128);
-
-				/* copy data on edge */
-
-				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				*out++=Y;			//dst[j+1] = Y;		// Luma
-									//j += 2;
-				//for( x=1; x < dim_x - 1; x+=2 )
-				x= window_width;
-				do
-				{
-					/* blue */
-		    			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    			b =  *center++;							//d_RGB_y[x];
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cr= (uint8_t)(0.713*(r-Y) + 128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-
-					*out++=Cr;
-					*out++=Y;
-
-		  		    /* green 2 */
-		    			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-		    			g =  *center++;		//g=d_RGB_y[x];
-		    			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-					low_left++;low_right++;high_left++;high_right++;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cb= (uint8_t)(0.564*(b-Y) + 128);
-					Cb= (mul16x16s(b-Y,coefCb)+128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cb;
-					*out++=Y;
-				}
-				while(x-=2);
-				/* copy data on edge */
-				*out++=Cr;	//dst[j+1] = Y;		// Luma
-				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-						//j += 2;
-
-				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-				low+=(2+remain_size);high+=(2+remain_size);
-				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-				/* green 1 */
-				r = (*left + *right)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-		    		g =  *center;			//d_RGB_y[x];
-		    		b = (*low + *high)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-
-				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-				//Cr= (uint8_t)(0.713*(r-Y) + 128);
-				Cr= (mul16x16s(r-Y,coefCr)+128);
-									/* copy data on edge */
-				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				*out++=Y;			//dst[j+1] = Y;		// Luma
-								//j += 2;
-				//for( x=1; x < dim_x - 1; x+=2 )
-				x= window_width;
-				do
-				{
-						/* green 1 */
-					r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-		    			g =  *center++;			//d_RGB_y[x];
-		    			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-					low_left++;low_right++;high_left++;high_right++;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cr= (uint8_t)(0.713*(r-Y) + 128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cr;
-					*out++=Y;
-		    				/* red */
-		    			r= *center++;							  //r =  d_RGB_y[x];
-		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cb= (uint8_t)(0.564*(b-Y) + 128);
-					Cb= (mul16x16s(b-Y,coefCb)+128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cb;
-					*out++=Y;
-
-				}
-				while(x-=2);
-				/* copy data on edge */
-				*out++=Cr;	//dst[j+1] = Y;		// Luma
-				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-						//j += 2;
-
-				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-				low+=(2+remain_size);high+=(2+remain_size);
-				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-
-			}
-			while(y-=2);
-}
-
-void debayerRGB_fast_mode3(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
-{
-	int x,y;
-	int r,g,b;
-	int window_width,window_height;
-	int remain_size;
-	if(ww && wh)   // working with window in image
-	{
-	    window_width= ww-2;
-	    window_height= wh-2;
-	    remain_size= dim_x-ww;
-	    src+=(dim_x*starty+startx);
-	}
-	else
-	{
-	    window_width= dim_x-2;
-	    window_height= dim_y-2;
-	    remain_size=0;
-	}
-	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
-	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
-	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
-	uint16_t Y,Cr,Cb;
-	uint8_t *out=dst;
-
-			//for( y=1; y < dim_y - 1; y+=2 )
-			y= window_height;
-			do
-			{
-		  		 /* green 2 */
-		    		r= (*low + *high)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-		    		g =  *center;		//g=d_RGB_y[x];
-		    		b= (*left + *right) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-
-				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-				//Cr= (uint8_t)(0.713*(r-Y) + 128);
-				Cr= (mul16x16s(r-Y,coefCr)+128);
-
-				/* copy data on edge */
-
-				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-				*out++=Y;			//dst[j+1] = Y;		// Luma
-									//j += 2;
-				//for( x=1; x < dim_x - 1; x+=2 )
-				x= window_width;
-				do
-				{
-
-		  		    	/* green 2 */
-		    			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-		    			g =  *center++;		//g=d_RGB_y[x];
-		    			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-					low_left++;low_right++;high_left++;high_right++;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cr= (uint8_t)(0.713*(r-Y) + 128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cr;
-					*out++=Y;
-					/* blue */
-		    			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    			b =  *center++;							//d_RGB_y[x];
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cb= (uint8_t)(0.564*(b-Y) + 128);
-					Cb= (mul16x16s(b-Y,coefCb)+128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cb;
-					*out++=Y;
-				}
-				while(x-=2);
-				/* copy data on edge */
-				*out++=Cr;	//dst[j+1] = Y;		// Luma
-				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-						//j += 2;
-
-				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-				low+=(2+remain_size);high+=(2+remain_size);
-				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-				/* red */
-		    		r= *center;							  //r =  d_RGB_y[x];
-		    		g= (*low + *left + *right + *high)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    		b= (*low_left + *low_right + *high_left + *high_right)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-
-				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-				//Cr= (uint8_t)(0.713*(r-Y) + 128);
-				Cr= (mul16x16s(r-Y,coefCr)+128);
-
-				*out++=Cr;
-				*out++=Y;
-				//for( x=1; x < dim_x - 1; x+=2 )
-				x= window_width;
-				do
-				{
-
-		    				/* red */
-		    			r= *center++;							  //r =  d_RGB_y[x];
-		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
-		    			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
-
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cr= (uint8_t)(0.713*(r-Y) + 128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cr;
-					*out++=Y;
-
-						/* green 1 */
-					r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
-		    			g =  *center++;			//d_RGB_y[x];
-		    			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
-					low_left++;low_right++;high_left++;high_right++;
-					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
-					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
-					//Cb= (uint8_t)(0.564*(b-Y) + 128);
-					Cb= (mul16x16s(b-Y,coefCb)+128);
-					Cr= (mul16x16s(r-Y,coefCr)+128);
-
-					*out++=Cb;
-					*out++=Y;
-
-				}
-				while(x-=2);
-				/* copy data on edge */
-				*out++=Cr;	//dst[j+1] = Y;		// Luma
-				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
-						//j += 2;
-
-				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
-				low+=(2+remain_size);high+=(2+remain_size);
-				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
-
-			}
-			while(y-=2);
-}
-
 static void BWto422(uint8_t *dst, uint8_t *src, int dim_x, int dim_y, int startx, int starty, int ww,int wh)
 {
 
@@ -1134,6 +503,36 @@ static void BWto422(uint8_t *dst, uint8_t *src, int dim_x, int dim_y, int startx
 	}*/
 }
 
+/* kernel of the debayer mode geom[6] for the frame and window in geom[0..5] */
+static void debayer_bind(cam4_rd_t *ctx, const int *geom)
+{
+	int	mode = geom[6];
+
+	switch(mode) {
+		case 0:
+		case 1:
+		case 2:
+		case 3:
+			if(arch_probe_fast_debayer(&ctx->d_api, geom[0], geom[2], geom[4]) <= 0)
+				ctx->d_api = default_debayer_api;
+			ctx->d_func = ctx->d_api.debayerRGB_func[mode];
+			ctx->d_name = ctx->d_api.name;
+			break;
+		case 4:
+			ctx->d_func = BWto422;
+			ctx->d_name = "BW";
+			break;
+
+		default:
+       			TRACE(0, "[err] Unknown encoding mode, allow 0, 1, 2, 3:%02x\n", mode);
+       			exit(-1);
+	}
+
+	memcpy(ctx->d_geom, geom, sizeof(ctx->d_geom));
+	TRACEP(0, "debayer: %s, mode %d, frame %dx%d window %dx%d at %d,%d\n",
+		ctx->d_name, mode, geom[0], geom[1], geom[4], geom[5], geom[2], geom[3]);
+}
+
 /************* bayer RGB => YCbCr 4:2:2 *****************/
 /* mode(left most):	0 - g1 				*/
 /*			1 - r				*/
@@ -1144,41 +543,29 @@ static void BWto422(uint8_t *dst, uint8_t *src, int dim_x, int dim_y, int startx
 
 static void debayerRGB_fast(uint8_t *dst, uint8_t *src, int dim_x, int dim_y, int mode, cam4_rd_t *ctx,int sse2_present,int mmx_present,int startx,int starty,int ww,int wh)
 {
+	int	geom[7];
+
 	if(!dim_x || !dim_y || !ww || !wh) {
 		TRACE(0, "Empty DIMS: dim: (x:%d y:%d) w:%d h:%d", dim_x, dim_y, ww, wh);
 		return;
 	}
 
 	if(mode < 0)
-		mode = ctx->fdata_h[ctx->idx].flags;
-#if 1
-	if(arch_probe_fast_debayer(&ctx->d_api, dim_x, startx, ww) <= 0)
-		ctx->d_api = default_debayer_api;
-#else
-	ctx->d_api = default_debayer_api;
-#endif
-	switch(mode & 0x1f) {
-		case 0:
-			ctx->d_api.debayerRGB_func[0](dst, src, dim_x, dim_y,startx,starty,ww,wh);
-			break;
-		case 1:
-			ctx->d_api.debayerRGB_func[1](dst, src, dim_x, dim_y,startx,starty,ww,wh);
-			break;
-		case 2:
-			ctx->d_api.debayerRGB_func[2](dst, src, dim_x, dim_y,startx,starty,ww,wh);
-			break;
-		case 3:
-			ctx->d_api.debayerRGB_func[3](dst, src, dim_x, dim_y,startx,starty,ww,wh);
-			break;
-		case 4:
-			BWto422(dst, src, dim_x, dim_y,startx,starty,ww,wh);
-			break;
+		mode = ctx->work->fdata_h.flags;
 
-		default:
-       			TRACE(0, "[err] Unknown encoding mode, allow 0, 1, 2, 3:%02x\n", mode);
-       			exit(-1);
+	/* the phase is of the frame: a window from an odd column or row starts on another colour */
+	if((mode & 0x1f) < 4)
+		mode ^= (startx & 1) | (starty & 1) << 1;
 
-	}
+	/* the kernel is resolved again only when the frame, the window or the phase change */
+	geom[0] = dim_x; geom[1] = dim_y;
+	geom[2] = startx; geom[3] = starty;
+	geom[4] = ww; geom[5] = wh;
+	geom[6] = mode & 0x1f;
+	if(!ctx->d_func || memcmp(geom, ctx->d_geom, sizeof(geom)))
+		debayer_bind(ctx, geom);
+
+	ctx->d_func(dst, src, dim_x, dim_y, startx, starty, ww, wh);
 }
 
 #if 0
@@ -1344,7 +731,7 @@ int cam4_dump_raw_frame(
 	size_t		done = 0 ;
 	static unsigned	idx		= 0;
 	static uint32_t	fseq_old	= 0;
-	uint32_t	fseq = ctx->FH.fseq;
+	uint32_t	fseq = ctx->work->FH.fseq;
 
 	if(fseq - fseq_old > 100000)
 		idx++;
@@ -1571,7 +958,7 @@ static int sensor_read_oob_bars(void *priv, uint8_t *data, size_t size, size_t t
 	if (src->type != P3_2D_BAR_FACE_ID_ROI)
 		return 0;
 
-	dst = (void*)shmaddr[c->frame_idx_done&1] + c->image_size;
+	dst = (void*)cam4_rd->shmaddr[c->frame_idx_done&1] + c->image_size;
 
 	uint16_t items = htons(src->items);
 
@@ -1757,231 +1144,607 @@ void calc_mean_dev(
             size++;
         }
 
+    if(!size)
+        return;
+
     *mean_out = (uint32_t)(mean/size);
     *dev_out  = (uint32_t)(dev/size);
 }
 
 
-static void* cam4_rd_process_real(void *priv)
+/* allocate the frame pool, slot 0 is the first to fill */
+static int frame_pool_alloc(cam4_rd_t *cam4_rd, uint32_t size)
 {
+	unsigned	i;
 
-	TRACE(0, "\n");
-	int	mmx_present  = 0;
-	int	sse2_present = 0;
+	if(cam4_rd->nslots < 2)
+		cam4_rd->nslots = 2;
 
-	common_t	*common;
-	cam4_rd_t 	*cam4_rd = priv ;
-	Yuv_Image	yuv_image[2];
+	cam4_rd->slots = calloc(cam4_rd->nslots, sizeof(*cam4_rd->slots));
+	if(!cam4_rd->slots)
+		return -1;
 
-	int shmid = shmget(key_common, sizeof(common_t), IPC_CREAT | 0666);
-	shmid1 = shmid;
-	if(shmid <0) {
-		ETRACE("Cant:shmget(key_common:%08x), %zd, ...)", key_common, sizeof(common_t));
-		return NULL;
+	for(i = 0; i < cam4_rd->nslots; i++) {
+		if(posix_memalign((void **)&cam4_rd->slots[i].buf, 16, size))
+			return -1;
+		cam4_rd->slots[i].alloc = size;
 	}
 
-	common = shmat(shmid, NULL, 0);
+	if(sem_init(&cam4_rd->slot_ready, 0, 0))
+		return -1;
 
-	if((intptr_t)common ==-1) {
-		ETRACE("Cant:shmat(key_common:%08x), %zd, ...)", key_common, sizeof(common_t));
-		return NULL;
-	}
+	cam4_rd->slot_head	= 0;
+	cam4_rd->slot_tail	= 0;
+	cam4_rd->fill_idx	= 0;
+	cam4_rd->work_idx	= 0;
+	cam4_rd->fill		= &cam4_rd->slots[0];
+	cam4_rd->work		= &cam4_rd->slots[0];
 
-	cam4_rd->common = common;
-	shmaddr3 = (uint8_t*)common;
+	TRACEPNF(0, "Frame pool: %u slots of %u\n", cam4_rd->nslots, size);
+	return 0;
+}
 
-	common->image_size = cam4_rd->FH.x_dim * cam4_rd->FH.y_dim * 2;
-	common->data_size  = common->image_size + 2*4096;
+/*
+ * Receiver: make the fill slot hold size bytes.  It is neither queued nor
+ * in work, so its buffer may be replaced; the content is of no use to a
+ * frame of another size.
+ */
+static int frame_reserve(cam4_rd_t *cam4_rd, uint32_t size)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+	uint8_t		*buf;
 
-	yuv_image[0].width	= cam4_rd->FH.x_dim;
-	yuv_image[0].height	= cam4_rd->FH.y_dim;
-	yuv_image[0].data_size  = common->image_size;
+	if(fs->alloc >= size)
+		return 0;
 
-	shmid = shmget(key_yuv1, common->data_size, IPC_CREAT | 0666);
-	shmid2 = shmid;
-	if(shmid <0) {
-		ETRACE("Cant:shmget(key_yuv1:%08x), %zd, ...)", key_yuv1, common->data_size);
-		return NULL;
-	}
+	if(posix_memalign((void **)&buf, 16, size))
+		return -1;
 
-	yuv_image[0].data = shmat(shmid,NULL,0);
+	TRACEPNF(0, "Frame slot %u: %u -> %u\n", cam4_rd->fill_idx, fs->alloc, size);
 
-	if((intptr_t)yuv_image[0].data ==-1) {
-		ETRACE("Cant:shmat(key_yuv1:%08x), %zd, ...)", key_yuv1, common->data_size);
-		return NULL;
-	}
-	shmaddr[0] = yuv_image[0].data;
+	free(fs->buf);
+	fs->buf		= buf;
+	fs->alloc	= size;
+	return 0;
+}
 
-	yuv_image[1].width	= cam4_rd->FH.x_dim;
-	yuv_image[1].height	= cam4_rd->FH.y_dim;
-	yuv_image[1].data_size  = common->image_size;
-	shmid = shmget(key_yuv2, common->data_size, IPC_CREAT | 0666);
-	shmid3 = shmid;
-	if(shmid <0) {
-		ETRACE("Cant:shmget(key_yuv2:%08x), %zd, ...)", key_yuv2, common->data_size);
-		return NULL;
-	}
+/*
+ * Receiver: hand the filled slot to the worker and move on to the next
+ * one.  The next slot must be neither queued nor in work: when the pool
+ * is exhausted the frame is dropped and its slot is filled again.
+ */
+static int frame_publish(cam4_rd_t *cam4_rd)
+{
+	unsigned	head = cam4_rd->slot_head;
 
-	yuv_image[1].data = shmat(shmid,NULL,0);
+	if(head + 1 - cam4_rd->slot_tail >= cam4_rd->nslots)
+		return -1;
 
-	if((intptr_t)yuv_image[1].data ==-1) {
-		ETRACE("Cant:shmat(key_yuv2:%08x), %zd, ...)", key_yuv2, common->data_size);
-		return NULL;
-	}
-	TRACEPNF(0, "KEY1=%08x\n", key_common);
-	TRACEPNF(0, "KEY2=%08x\n", key_yuv1);
-	TRACEPNF(0, "KEY3=%08x\n", key_yuv2);
+	__sync_synchronize();
+	cam4_rd->slot_head = head + 1;
+	cam4_rd->prev = cam4_rd->fill;
 
-	shmaddr[1] = yuv_image[1].data;
+	if(++cam4_rd->fill_idx == cam4_rd->nslots)
+		cam4_rd->fill_idx = 0;
+	cam4_rd->fill = &cam4_rd->slots[cam4_rd->fill_idx];
 
-	common->nbins		= 0;
-	common->sensWidth	= yuv_image[0].width;
-	common->sensHeight	= yuv_image[0].height;
-	common->width		= common->sensWidth;
-	common->height		= common->sensHeight;
-	common->startx		= 0;
-	common->starty		= 0;
-	snprintf(common->window_title, sizeof(common->window_title) -1, "%s %s", cam4_rd->device_name, cam4_rd->camera_ip_str);
-	common->window_title[sizeof(common->window_title) -1] = 0;
+	sem_post(&cam4_rd->slot_ready);
+	return 0;
+}
 
-	TRACEP(0, "W:%4"PRIi32" H: %4"PRIi32" w:%4"PRIi32" h: %4"PRIi32"\n",
-		common->sensWidth,
-		common->sensHeight,
-		yuv_image[0].width,
-		yuv_image[0].height
-	);
+/* worker: the oldest published frame, NULL after a second of silence */
+static frame_slot_t *frame_get(cam4_rd_t *cam4_rd)
+{
+	struct timespec	ts;
 
-	//check_mmx_sse2(&sse2_present,&mmx_present);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec++;
 
-	cam4_rd->start_mode |= frame_done_flag;
-	int rc;
-	uint16_t *img16;
-	img16=(uint16_t*)malloc(common->image_size);
+	if(sem_timedwait(&cam4_rd->slot_ready, &ts))
+		return NULL;
 
-	while (no_sig_exit) {
-		rc = sleep(3) ;
-		if(!rc || !(errno == EINTR) )
-			continue;
+	__sync_synchronize();
+	cam4_rd->work = &cam4_rd->slots[cam4_rd->work_idx];
+	return cam4_rd->work;
+}
 
-		int j = cam4_rd->idx ^ 1 ;
-		cam4_rd->img = cam4_rd->buff_fd[j];
+/* worker: the slot is free for the receiver again */
+static void frame_put(cam4_rd_t *cam4_rd)
+{
+	if(++cam4_rd->work_idx == cam4_rd->nslots)
+		cam4_rd->work_idx = 0;
 
-        cam4_script_processing(cam4_rd);
+	__sync_synchronize();
+	cam4_rd->slot_tail++;
+}
 
-		if (cam4_rd->dumpraw_time.tv_sec != 0 && (cam4_rd->dumpraw_time.tv_sec < tv.tv_sec || (cam4_rd->dumpraw_time.tv_sec == tv.tv_sec && cam4_rd->dumpraw_time.tv_usec < tv.tv_usec))) {
-			cam4_rd->dumpraw_time.tv_sec = 0;
-			cam4_dump_raw_frame(cam4_rd, cam4_rd->img, cam4_rd->FH.fsize & 0xfffffff);
-		}
-		/* TEST OOB */
+static const char *lat_names[LAT_STAGES] = {
+	[LAT_WIRE]		= "camera->first FD",
+	[LAT_REASSEMBLY]	= "first->last FD",
+	[LAT_LUT]		= "last FD->LUT",
+	[LAT_PUBLISH]		= "LUT->shm",
+	[LAT_TOTAL]		= "camera->shm",
+};
 
-		if ((cam4_rd->FH.osize & 0xfffffff) > 0) {
-			uint8_t* oob_data = cam4_rd->img + (cam4_rd->FH.fsize & 0xfffffff);
-			parse_oob_data(cam4_rd, oob_data, cam4_rd->FH.osize & 0xfffffff);
-		}
+static inline void latency_add(latency_stats_t *lat, unsigned stage, uint64_t us)
+{
+	unsigned	k = us > 1 ? 63 - __builtin_clzll(us) : 0;
 
-		common->frame_idx_done = j;
+	if(k >= LAT_BUCKETS)
+		k = LAT_BUCKETS - 1;
+	if(us > UINT32_MAX)
+		us = UINT32_MAX;
 
-		cam4_rd_do_LUT(img16, cam4_rd->img, cam4_rd->FH.fsize);
+	lat->hist[stage][k]++;
+	lat->sum[stage] += us;
+	if(lat->max[stage] < us)
+		lat->max[stage] = us;
+}
 
-		write_raw_video(cam4_rd, (uint8_t*)cam4_rd->img, cam4_rd->FH.fsize & 0xfffffff);
+/*
+ * Counter block to the shared segment, its first member is the seq: odd
+ * while the copy is under way.  A reader retries while seq is odd or has
+ * moved across its read.
+ */
+static void shm_publish(void *dst, const void *src, size_t size)
+{
+	volatile uint32_t	*seq = dst;
 
-		calc_raw_hist(cam4_rd->img, common);
+	(*seq)++;
+	__sync_synchronize();
+	memcpy((uint8_t *)dst + sizeof(*seq), (const uint8_t *)src + sizeof(*seq), size - sizeof(*seq));
+	__sync_synchronize();
+	(*seq)++;
+}
 
-		//calculate components hists
-		int x,y;
+/* missing regions of fs, bytes of the packed frame, to pixels in the shared segment */
+static void frame_missing_publish(common_t *common, frame_slot_t *fs)
+{
+	uint32_t	psize = fs->FH.fsize & 0xfffffff, start, end;
+	unsigned	gpix, group = cam4_lut_group(fs->FH.fsize >> 28, &gpix);
+	unsigned	i, n = 0;
+
+	common->frame_partial = fs->partial;
+
+	for(i = 0; i < fs->nmissing; i++) {
+		start	= fs->missing[i].start;
+		end	= start + fs->missing[i].count;
+		if(start >= psize)
+			continue;			/* OOB data only */
+		if(end > psize)
+			end = psize;
+
+		/* a group cut by the hole is missing as a whole */
+		if(group) {
+			start	= start / group * gpix;
+			end	= (end + group - 1) / group * gpix;
+		} else {
+			start	= 0;
+			end	= common->sensWidth * common->sensHeight;
+		}
 
-		// calculate mean and dev statistic - upper left
-		unsigned long	size;
-		int16_t		v, v1;
+		common->frame_missing[n].start = start;
+		common->frame_missing[n].count = end - start;
+		n++;
+		if(!group)
+			break;
+	}
 
+	common->frame_nmissing = n;
+}
 
-		calc_mean_dev(img16,common->sensWidth,64,                 common->sensWidth/2, 64,                  common->sensHeight/2, &(common->mean[0]),&(common->stddev[0]));
-		calc_mean_dev(img16,common->sensWidth,common->sensWidth/2,common->sensWidth-64,64,                  common->sensHeight/2, &(common->mean[1]),&(common->stddev[1]));
-		calc_mean_dev(img16,common->sensWidth,64,                 common->sensWidth/2, common->sensHeight/2,common->sensHeight-64,&(common->mean[2]),&(common->stddev[2]));
-		calc_mean_dev(img16,common->sensWidth,common->sensWidth/2,common->sensWidth-64,common->sensHeight/2,common->sensHeight-64,&(common->mean[3]),&(common->stddev[3]));
+/* the worker published fs at t_pub, its LUT was done at t_lut */
+static void latency_account(cam4_rd_t *cam4_rd, frame_slot_t *fs, uint64_t t_lut, uint64_t t_pub)
+{
+	latency_stats_t	*lat = &cam4_rd->latency;
+	uint64_t	t_cam = 0;
 
+	/* nothing arrived: the frame was repaired as a whole */
+	if(!fs->t_first)
+		return;
 
-		// calculate difference between quadrants (upper left) - (upper right)
-		int32_t d=0;
-		size =0;
-		for (y=64;y<((common->sensHeight)/2);y++){
-		    	v = img16[(common->sensWidth)/2-10+y*common->sensWidth];
-		    	v1= img16[(common->sensWidth)/2+10+y*common->sensWidth];
-			d += v1-v;
-			size++;
-			}
-		common->diff[0] = d/((int32_t)size);
-//		TRACEP(0, "R: diff = %d \n",common->diff[0]);
-
-		// calculate difference between quadrants (lower left) - (lower right)
-		d = 0;
-		size =0;
-		for (y=((common->sensHeight)/2);y<((common->sensHeight)-64);y++){
-		    	v = img16[(common->sensWidth)/2-10+y*common->sensWidth];
-		    	v1= img16[(common->sensWidth)/2+10+y*common->sensWidth];
-			d += v1-v;
-			size++;
-			}
-		common->diff[1] = d/((int32_t)size);
+	if(fs->FH.ts > BUGGY_FILETIME_OF_1970_01_01)
+		t_cam = (fs->FH.ts - BUGGY_FILETIME_OF_1970_01_01) / 10;
 
+	lat->frames++;
+	if(t_cam && t_cam <= fs->t_first) {
+		latency_add(lat, LAT_WIRE, fs->t_first - t_cam);
+		latency_add(lat, LAT_TOTAL, t_pub - t_cam);
+	} else if(t_cam)
+		lat->clock_skew++;
 
-		// calculate difference between quadrants (upper left) - (lower left)
-		d = 0;
-		size =0;
-		for (x=64;x<((common->sensWidth)/2);x++){
-		    	v = img16[ x + ((common->sensHeight)/2 - 10)*common->sensWidth];
-		    	v1= img16[ x + ((common->sensHeight)/2 + 10)*common->sensWidth];
-			d += v1-v;
-			size++;
-			}
-		common->diff[2] = d/((int32_t)size);
-
-		// calculate difference between quadrants (upper right) - (lower right)
-		d = 0;
-		size =0;
-		for (x=((common->sensWidth)/2);x<((common->sensWidth)-64);x++){
-		    	v = img16[ x + ((common->sensHeight)/2 - 10)*common->sensWidth];
-		    	v1= img16[ x + ((common->sensHeight)/2 + 10)*common->sensWidth];
-			d += v1-v;
-			size++;
-			}
-		common->diff[3] = d/((int32_t)size);
+	latency_add(lat, LAT_REASSEMBLY, fs->t_last - fs->t_first);
+	latency_add(lat, LAT_LUT, t_lut > fs->t_last ? t_lut - fs->t_last : 0);
+	latency_add(lat, LAT_PUBLISH, t_pub - t_lut);
+	lat->seq++;
 
-#ifdef CAM4_PS_LIB
-		if(cam4_ps_cb)
-			cam4_ps_cb(cam4_rd);
-#endif
+	shm_publish(&cam4_rd->common->latency, lat, sizeof(*lat));
+}
 
-		//draw state data
-		if(cam4_rd->camctl_mode)
-			draw_camctl_stat(cam4_rd, common);
+/* upper bound of the bucket holding the q-th fraction of the frames */
+static uint64_t latency_quantile(latency_stats_t *lat, unsigned stage, double q)
+{
+	uint64_t	n = 0, total = 0;
+	unsigned	k;
 
-		debayerRGB_fast((uint8_t *)yuv_image[j].data,	// dst
-			    cam4_rd->img,			// src
-			    common->sensWidth,			// dim_x
-			    common->sensHeight,			// dim_y
-			    debayer_mode,
-			    cam4_rd,
-			    sse2_present,
-			    mmx_present,
-			    common->startx-common->startx%16,	// startx
-			    common->starty-common->starty%16,	// starty
-			    common->width,			// ww
-			    common->height			// wh
-		);
+	for(k = 0; k < LAT_BUCKETS; k++)
+		total += lat->hist[stage][k];
 
-		common->frame_done = 1;
-		gettimeofday(&tv,NULL);
+	for(k = 0; k < LAT_BUCKETS - 1; k++) {
+		n += lat->hist[stage][k];
+		if(n >= total * q)
+			break;
+	}
 
-		if (cam4_rd->dumpyuv_time.tv_sec != 0 && (cam4_rd->dumpyuv_time.tv_sec < tv.tv_sec || (cam4_rd->dumpyuv_time.tv_sec == tv.tv_sec && cam4_rd->dumpyuv_time.tv_usec < tv.tv_usec))) {
+	return 2ull << k;
+}
+
+static void latency_dump(cam4_rd_t *cam4_rd)
+{
+	latency_stats_t	*lat = &cam4_rd->latency;
+	unsigned	i, k;
+	uint64_t	n;
+
+	TRACEPNF(0, "Latency of stream %u, %"PRIu64" frames, %u before their camera ts:\n",
+		cam4_rd->stream_idx, lat->frames, lat->clock_skew);
+
+	for(i = 0; i < LAT_STAGES; i++) {
+		for(n = 0, k = 0; k < LAT_BUCKETS; k++)
+			n += lat->hist[i][k];
+		if(!n)
+			continue;
+
+		TRACEPNF(0, "\t%-18s mean %8"PRIu64" us  p50 <%8"PRIu64" us  p99 <%8"PRIu64" us  max %8u us\n",
+			lat_names[i], lat->sum[i] / n,
+			latency_quantile(lat, i, 0.5), latency_quantile(lat, i, 0.99),
+			lat->max[i]);
+	}
+}
+
+/* (re)make yuv segment n of common->data_size bytes */
+static int yuv_shm_attach(cam4_rd_t *cam4_rd, unsigned n, Yuv_Image *yuv)
+{
+	common_t	*common = cam4_rd->common;
+	key_t		key = key_stream(n ? key_yuv2 : key_yuv1, cam4_rd->stream_idx);
+	int		*shmid = n ? &cam4_rd->shmid3 : &cam4_rd->shmid2;
+
+	/* a consumer still attached keeps the old one until it lets go */
+	if(cam4_rd->shmaddr[n]) {
+		shmdt(cam4_rd->shmaddr[n]);
+		shmctl(*shmid, IPC_RMID, NULL);
+		cam4_rd->shmaddr[n] = NULL;
+	}
+
+	*shmid = shmget(key, common->data_size, IPC_CREAT | 0666);
+
+	/* left smaller by an earlier run */
+	if(*shmid < 0 && errno == EINVAL && (*shmid = shmget(key, 0, 0)) >= 0) {
+		shmctl(*shmid, IPC_RMID, NULL);
+		*shmid = shmget(key, common->data_size, IPC_CREAT | 0666);
+	}
+
+	if(*shmid < 0) {
+		ETRACE("Cant:shmget(key_yuv%u:%08x), %zd, ...)", n + 1, key, common->data_size);
+		return -1;
+	}
+
+	yuv->data = shmat(*shmid, NULL, 0);
+	if((intptr_t)yuv->data == -1) {
+		ETRACE("Cant:shmat(key_yuv%u:%08x), %zd, ...)", n + 1, key, common->data_size);
+		yuv->data = NULL;
+		return -1;
+	}
+
+	cam4_rd->shmaddr[n] = yuv->data;
+	return 0;
+}
+
+/* close the recording of the old geometry, the next frame opens another */
+static void video_restart(cam4_rd_t *cam4_rd)
+{
+	if(cam4_rd->video_writing == VIDEO_WRITE_PROCESS) {
+		cam4_rd->video_writing = VIDEO_WRITE_FINISH;
+		write_video(cam4_rd, NULL, 0);
+		cam4_rd->video_writing = VIDEO_WRITE_START;
+	}
+
+	if(cam4_rd->raw_video_writing == VIDEO_WRITE_PROCESS) {
+		cam4_rd->raw_video_writing = VIDEO_WRITE_FINISH;
+		write_raw_video(cam4_rd, NULL, 0);
+		cam4_rd->raw_video_writing = VIDEO_WRITE_START;
+	}
+}
+
+/*
+ * Worker: fit the pixel buffers and the yuv segments to the frame.  The
+ * geometry (x_dim, y_dim, sample format) may change at any FH when the
+ * sensor mode or the ROI is switched.  Segments that are too small are
+ * remade under the same keys and the new size is published in common;
+ * consumers reattach when geometry_seq moves.
+ */
+static int frame_geometry(cam4_rd_t *cam4_rd, frame_slot_t *fs, Yuv_Image *yuv_image)
+{
+	common_t	*common = cam4_rd->common;
+	unsigned	w = fs->FH.x_dim;
+	unsigned	h = fs->FH.y_dim;
+	size_t		image_size = (size_t)w * h * 2;
+	size_t		need = (size_t)(fs->FH.fsize & 0xfffffff) * 16 / (8+2*(fs->FH.fsize>>28));
+	unsigned	n;
+
+	/* LUT output and 16 bit samples of the frame, never less than W x H */
+	if(need < image_size)
+		need = image_size;
+
+	if(need > cam4_rd->img_size) {
+		free(cam4_rd->img16);
+		free(cam4_rd->buff_img);
+		cam4_rd->img16		= malloc(need);
+		cam4_rd->buff_img	= malloc(need);
+		cam4_rd->img_size	= need;
+		if(!cam4_rd->img16 || !cam4_rd->buff_img) {
+			ETRACE("Cant: allocate %zu for %ux%u\n", need, w, h);
+			return -1;
+		}
+	}
+
+	if(w == common->sensWidth && h == common->sensHeight)
+		return 0;
+
+	TRACEPNF(0, "Geometry: %ux%u -> %ux%u\n", common->sensWidth, common->sensHeight, w, h);
+
+	if(common->sensWidth)
+		video_restart(cam4_rd);
+	cam4_rd->w = w;
+	cam4_rd->h = h;
+
+	common->image_size = image_size;
+	if(image_size + 2*4096 > common->data_size) {
+		common->data_size = image_size + 2*4096;
+		for(n = 0; n < 2; n++)
+			if(yuv_shm_attach(cam4_rd, n, &yuv_image[n]))
+				return -1;
+	}
+
+	for(n = 0; n < 2; n++) {
+		yuv_image[n].width	= w;
+		yuv_image[n].height	= h;
+		yuv_image[n].data_size	= image_size;
+	}
+
+	/* the viewer window: the whole frame as far as the viewer fits it */
+	common->sensWidth	= w;
+	common->sensHeight	= h;
+	common->width		= common->xvWidth && common->xvWidth < w ? common->xvWidth : w;
+	common->height		= common->xvHeight && common->xvHeight < h ? common->xvHeight : h;
+	common->startx		= 0;
+	common->starty		= 0;
+
+	__sync_synchronize();
+	common->geometry_seq++;
+
+	TRACEP(0, "W:%4"PRIi32" H: %4"PRIi32" w:%4"PRIi32" h: %4"PRIi32"\n",
+		common->sensWidth,
+		common->sensHeight,
+		common->width,
+		common->height
+	);
+	return 0;
+}
+
+static void* cam4_rd_process_real(void *priv)
+{
+
+	TRACE(0, "\n");
+	int	mmx_present  = 0;
+	int	sse2_present = 0;
+
+	common_t	*common;
+	cam4_rd_t 	*cam4_rd = priv ;
+	Yuv_Image	yuv_image[2];
+
+	/* every camera stream has its own segments */
+	key_t	key1 = key_stream(key_common, cam4_rd->stream_idx);
+
+	int shmid = shmget(key1, sizeof(common_t), IPC_CREAT | 0666);
+	cam4_rd->shmid1 = shmid;
+	if(shmid <0) {
+		ETRACE("Cant:shmget(key_common:%08x), %zd, ...)", key1, sizeof(common_t));
+		return NULL;
+	}
+
+	common = shmat(shmid, NULL, 0);
+
+	if((intptr_t)common ==-1) {
+		ETRACE("Cant:shmat(key_common:%08x), %zd, ...)", key1, sizeof(common_t));
+		return NULL;
+	}
+
+	cam4_rd->common = common;
+	cam4_rd->shmaddr3 = (uint8_t*)common;
+
+	/* the yuv segments are sized by the first frame */
+	common->sensWidth	= 0;
+	common->sensHeight	= 0;
+	common->image_size	= 0;
+	common->data_size	= 0;
+	memset(yuv_image, 0, sizeof(yuv_image));
+
+	TRACEPNF(0, "KEY1=%08x\n", key1);
+	TRACEPNF(0, "KEY2=%08x\n", key_stream(key_yuv1, cam4_rd->stream_idx));
+	TRACEPNF(0, "KEY3=%08x\n", key_stream(key_yuv2, cam4_rd->stream_idx));
+	TRACEPNF(0, "LUT unpack: %s\n", cam4_lut_kernel());
+
+	common->nbins		= 0;
+	if(cam4_rd->stream_idx)
+		snprintf(common->window_title, sizeof(common->window_title) -1, "%s %u.%u.%u.%u/%u", cam4_rd->device_name,
+			INET2DIG2(&cam4_rd->stream_src), cam4_rd->stream_lid);
+	else
+		snprintf(common->window_title, sizeof(common->window_title) -1, "%s %s", cam4_rd->device_name, cam4_rd->camera_ip_str);
+	common->window_title[sizeof(common->window_title) -1] = 0;
+
+	//check_mmx_sse2(&sse2_present,&mmx_present);
+
+	uint16_t *img16 = NULL;
+	int j = 1;
+	frame_slot_t *fs;
+	unsigned gpix;
+	uint64_t t_lut;
+
+	while (no_sig_exit) {
+		if(!(fs = frame_get(cam4_rd)))
+			continue;
+
+		/* a new sensor mode or ROI: resize everything before use */
+		if(frame_geometry(cam4_rd, fs, yuv_image)) {
+			frame_put(cam4_rd);
+			break;
+		}
+		img16 = cam4_rd->img16;
+
+		/* yuv output is double buffered in the shared segments */
+		j ^= 1;
+		cam4_rd->img = fs->buf;
+
+		/* the test scripts drive the configured camera */
+		if(!cam4_rd->stream_idx)
+			cam4_script_processing(cam4_rd);
+
+		/* a fused frame has no raw samples: the dump takes the next one */
+		if (!fs->fused && cam4_rd->dumpraw_time.tv_sec != 0 && (cam4_rd->dumpraw_time.tv_sec < tv.tv_sec || (cam4_rd->dumpraw_time.tv_sec == tv.tv_sec && cam4_rd->dumpraw_time.tv_usec < tv.tv_usec))) {
+			cam4_rd->dumpraw_time.tv_sec = 0;
+			cam4_dump_raw_frame(cam4_rd, cam4_rd->img, fs->FH.fsize & 0xfffffff);
+		}
+		/* TEST OOB */
+
+		if ((fs->FH.osize & 0xfffffff) > 0) {
+			uint8_t* oob_data = cam4_rd->img + (fs->FH.fsize & 0xfffffff);
+			parse_oob_data(cam4_rd, oob_data, fs->FH.osize & 0xfffffff);
+		}
+
+		common->frame_idx_done = j;
+		frame_missing_publish(common, fs);
+
+		/*
+		 * fused frames came through the LUT in the receiver, the others
+		 * keep their raw samples in the slot for -y and the recording
+		 */
+		if(!fs->fused) {
+			if(cam4_lut_group(fs->FH.fsize >> 28, &gpix)) {
+				cam4_rd_LUT_frame(img16, cam4_rd->buff_img, fs->buf, fs->FH.fsize, fs->FH.osize);
+				cam4_rd->img = cam4_rd->buff_img;
+			}
+
+			write_raw_video(cam4_rd, fs->buf, fs->FH.fsize & 0xfffffff);
+		}
+
+		calc_raw_hist(cam4_rd->img, common);
+
+		/*
+		 * no 16 bit samples behind a fused frame; the quadrants keep a
+		 * 64 pixel border and need a row and a column inside it
+		 */
+		if(!fs->fused && common->sensWidth >= QUAD_MIN && common->sensHeight >= QUAD_MIN) {
+			//calculate components hists
+			int x,y;
+
+			// calculate mean and dev statistic - upper left
+			unsigned long	size;
+			int16_t		v, v1;
+
+
+			calc_mean_dev(img16,common->sensWidth,64,                 common->sensWidth/2, 64,                  common->sensHeight/2, &(common->mean[0]),&(common->stddev[0]));
+			calc_mean_dev(img16,common->sensWidth,common->sensWidth/2,common->sensWidth-64,64,                  common->sensHeight/2, &(common->mean[1]),&(common->stddev[1]));
+			calc_mean_dev(img16,common->sensWidth,64,                 common->sensWidth/2, common->sensHeight/2,common->sensHeight-64,&(common->mean[2]),&(common->stddev[2]));
+			calc_mean_dev(img16,common->sensWidth,common->sensWidth/2,common->sensWidth-64,common->sensHeight/2,common->sensHeight-64,&(common->mean[3]),&(common->stddev[3]));
+
+
+			// calculate difference between quadrants (upper left) - (upper right)
+			int32_t d=0;
+			size =0;
+			for (y=64;y<((common->sensHeight)/2);y++){
+			    	v = img16[(common->sensWidth)/2-10+y*common->sensWidth];
+			    	v1= img16[(common->sensWidth)/2+10+y*common->sensWidth];
+				d += v1-v;
+				size++;
+				}
+			common->diff[0] = d/((int32_t)size);
+	//		TRACEP(0, "R: diff = %d \n",common->diff[0]);
+
+			// calculate difference between quadrants (lower left) - (lower right)
+			d = 0;
+			size =0;
+			for (y=((common->sensHeight)/2);y<((common->sensHeight)-64);y++){
+			    	v = img16[(common->sensWidth)/2-10+y*common->sensWidth];
+			    	v1= img16[(common->sensWidth)/2+10+y*common->sensWidth];
+				d += v1-v;
+				size++;
+				}
+			common->diff[1] = d/((int32_t)size);
+
+
+			// calculate difference between quadrants (upper left) - (lower left)
+			d = 0;
+			size =0;
+			for (x=64;x<((common->sensWidth)/2);x++){
+			    	v = img16[ x + ((common->sensHeight)/2 - 10)*common->sensWidth];
+			    	v1= img16[ x + ((common->sensHeight)/2 + 10)*common->sensWidth];
+				d += v1-v;
+				size++;
+				}
+			common->diff[2] = d/((int32_t)size);
+
+			// calculate difference between quadrants (upper right) - (lower right)
+			d = 0;
+			size =0;
+			for (x=((common->sensWidth)/2);x<((common->sensWidth)-64);x++){
+			    	v = img16[ x + ((common->sensHeight)/2 - 10)*common->sensWidth];
+			    	v1= img16[ x + ((common->sensHeight)/2 + 10)*common->sensWidth];
+				d += v1-v;
+				size++;
+				}
+			common->diff[3] = d/((int32_t)size);
+		}
+
+		t_lut = time_us();
+
+#ifdef CAM4_PS_LIB
+		if(cam4_ps_cb)
+			cam4_ps_cb(cam4_rd);
+#endif
+
+		//draw state data
+		if(cam4_rd->camctl_mode)
+			draw_camctl_stat(cam4_rd, common);
+
+		debayerRGB_fast((uint8_t *)yuv_image[j].data,	// dst
+			    cam4_rd->img,			// src
+			    common->sensWidth,			// dim_x
+			    common->sensHeight,			// dim_y
+			    debayer_mode,
+			    cam4_rd,
+			    sse2_present,
+			    mmx_present,
+			    common->startx,			// startx
+			    common->starty,			// starty
+			    common->width,			// ww
+			    common->height			// wh
+		);
+
+		common->frame_done = 1;
+		gettimeofday(&tv,NULL);
+		latency_account(cam4_rd, fs, t_lut, tv.tv_sec * 1000000ull + tv.tv_usec);
+
+		if (cam4_rd->dumpyuv_time.tv_sec != 0 && (cam4_rd->dumpyuv_time.tv_sec < tv.tv_sec || (cam4_rd->dumpyuv_time.tv_sec == tv.tv_sec && cam4_rd->dumpyuv_time.tv_usec < tv.tv_usec))) {
 			cam4_rd->dumpyuv_time.tv_sec = 0;
 			cam4_dump_YCbCr_frame(cam4_rd,(uint8_t *)yuv_image[j].data, common->width * common->height * 2);
 		}
 		write_video(cam4_rd, (uint8_t*)yuv_image[j].data, common->width * common->height * 2);
-		cam4_rd->start_mode |= frame_done_flag;
+		frame_put(cam4_rd);
 	}
 
-	free((void*)img16);
+	latency_dump(cam4_rd);
+	free((void*)cam4_rd->img16);
+	free(cam4_rd->buff_img);
 
 	if(cam4_rd->flipped_img)
 		free(cam4_rd->flipped_img);
@@ -2000,16 +1763,14 @@ static void *cam4_rd_process(void *priv)
 static int write_frame(cam4_rd_t *cam4_rd)
 {
     int		res;
-    uint32_t	write_size = cam4_rd->FH.fsize & ~(0xf<<28);
+    frame_slot_t	*fs = cam4_rd->work;
+    uint32_t	write_size = fs->FH.fsize & ~(0xf<<28);
     uint32_t	todo = write_size, done = 0 ;
-    uint8_t	idx ;
 
-    idx = cam4_rd->idx ^ 1 ;
-
-TRACEPNF(0, "[line:%d] w:%d h:%d | todo = %d\n", __LINE__, cam4_rd->FH.y_dim, cam4_rd->FH.x_dim, todo);
+TRACEPNF(0, "[line:%d] w:%d h:%d | todo = %d\n", __LINE__, fs->FH.y_dim, fs->FH.x_dim, todo);
 
     do {
-    	res = write(cam4_rd->fd, cam4_rd->buff_fd[idx] + done, todo);
+    	res = write(cam4_rd->fd, fs->buf + done, todo);
 
 	if(res < 0 ) {
 
@@ -2027,8 +1788,6 @@ TRACEPNF(0, "[line:%d] w:%d h:%d | todo = %d\n", __LINE__, cam4_rd->FH.y_dim, ca
 
     } while(todo) ;
 
-    cam4_rd->start_mode |= frame_done_flag;
-
     TRACEP(0, "[line:%d] res = %d write_size = %d done = %d\n", __LINE__, res, todo, done);
     return 0;
 }
@@ -2038,7 +1797,10 @@ static int write_separate(cam4_rd_t *cam4_rd)
     char	frame_f[255] = {};
     int		res;
 
-    sprintf(frame_f, "frame_%05d.raw", cam4_rd->frame_idx) ;
+    if(cam4_rd->stream_idx)
+	sprintf(frame_f, "frame_%u_%05d.raw", cam4_rd->stream_idx, cam4_rd->frame_idx) ;
+    else
+	sprintf(frame_f, "frame_%05d.raw", cam4_rd->frame_idx) ;
 
     cam4_rd->fd = open(frame_f, O_CREAT | O_WRONLY, 0660);
     if(cam4_rd->fd < 0) {
@@ -2058,16 +1820,12 @@ static int write_separate(cam4_rd_t *cam4_rd)
 void* cam4_rd_dump_buf(void *priv)
 {
     cam4_rd_t 	*cam4_rd = priv ;
-    int		rc ;
-
-    cam4_rd->start_mode |= frame_done_flag;
 
     do {
-	rc = sleep(3) ;
-
-	if( (rc != 0) && (errno == EINTR) ) {
+	if( frame_get(cam4_rd) ) {
 
 	    cam4_rd->write_cb(cam4_rd);
+	    frame_put(cam4_rd);
 	    if( cam4_rd->frame_idx == (cam4_rd->frame_num -1) ) {
 		TRACE(0, "[%d] frames succsessfully wrote \n", cam4_rd->frame_num);
 		//exit(-1);
@@ -2078,7 +1836,7 @@ void* cam4_rd_dump_buf(void *priv)
 
 	}
 
-    } while(1) ;
+    } while(no_sig_exit) ;
 
     no_sig_exit = 0;
 
@@ -2086,167 +1844,605 @@ void* cam4_rd_dump_buf(void *priv)
 }
 
 
-static inline int cam4_rd_read_fh(void *ptr, cam4_rd_t *cam4_rd, unsigned len)
+/* account a hole of gap bytes in the current frame */
+static inline void fd_missed(cam4_rd_t *cam4_rd, uint32_t gap)
 {
-	static unsigned lag = 0;
-	part_num++;
-	video_frame_raw_hdr_t *FH  = &cam4_rd->FH;
-	video_frame_raw_hdr_t *src = ptr;
-
-	FH->lid   = ntohl(src->lid);
-	FH->fseq  = ntohl(src->fseq);
-	FH->gid   = src->gid;
-	FH->ts    = filetime_to_host(&src->ts);
-	FH->x_dim = ntohs(src->x_dim);
-	FH->y_dim = ntohs(src->y_dim);
-	FH->fsize = ntohl(src->fsize);
+	unsigned	frag = cam4_rd->fd_size ? cam4_rd->fd_size : RING_FRAG_PAYLOAD;
+	unsigned	n = (gap + frag - 1) / frag;
 
-	if(len >= sizeof(video_frame_raw_hdr_t))
-		FH->osize = ntohl(src->osize);
-	else
-		FH->osize = 0;
+	cam4_rd->frame_fd_missing	+= n;
+	cam4_rd->stats.fd_missing	+= n;
+	cam4_rd->stats.fd_missing_bytes	+= gap;
+}
 
-	if(offs_static != cam4_rd->fh_size) {
-		TRACEPNF(0, "WARN: Tail missed:%08x@%08x [%08x]\n", cam4_rd->fh_size - offs_static, offs_static, cam4_rd->fh_size);
+/* coverage grid of frag bytes for the slot, nothing covered */
+static void frame_cover_init(frame_slot_t *fs, unsigned frag)
+{
+	unsigned	words;
+
+	fs->frag	= frag;
+	fs->bits	= (fs->size + frag - 1) / frag;
+	fs->have	= 0;
+	words		= (fs->bits + 31) / 32;
+
+	if(words > fs->cover_words) {
+		free(fs->cover);
+		fs->cover = malloc(words * sizeof(*fs->cover));
+		fs->cover_words = fs->cover ? words : 0;
+		if(!fs->cover) {
+			fs->irregular = 1;
+			return;
+		}
 	}
 
-	cam4_rd->fh_size	= (FH->fsize&0xfffffff) + (FH->osize&0xfffffff);
-	cam4_rd->bits		= 8+2*(FH->fsize>>28);
-
-	/* keep last frame data header */
-	if(cam4_rd->pFD)
-		memcpy(cam4_rd->fdata_h+cam4_rd->idx, cam4_rd->pFD, sizeof(*cam4_rd->pFD));
-	else
-		cam4_rd->fdata_h[cam4_rd->idx].flags = 0x4;
-
-	TRACEPNF(0, "LID:%08x SEQ: %08x SZ:%8d@%016"PRIx64" %2dbit cm:%02x %5d x %5d oob:%5d lag:%d\n",
-	    FH->lid,
-	    FH->fseq,
-	    cam4_rd->fh_size,
-	    FH->ts,
-	    cam4_rd->bits,
-	    cam4_rd->fdata_h[cam4_rd->idx].flags,
-	    FH->x_dim,
-	    FH->y_dim,
-	    (FH->osize&0xfffffff),
-	    lag
-	);
+	memset(fs->cover, 0, words * sizeof(*fs->cover));
 
-	if((FH->lid &0xff) == 0x09)
-		part_num--;
+	/* a group is cut by one boundary at most */
+	if(fs->fused && frag < fs->group)
+		fs->fused = 0;
 
-	if(FH->fseq !=  part_num) {
-	    TRACEPNF(0, "skipped real id = %08x, local id = %08x. Adjust....\n", FH->fseq, part_num) ;
-	    part_num = FH->fseq ;
+	if(fs->fused && fs->bits * fs->group > fs->edge_size) {
+		free(fs->edge);
+		fs->edge = malloc(fs->bits * fs->group);
+		fs->edge_size = fs->edge ? fs->bits * fs->group : 0;
+		if(!fs->edge)
+			fs->fused = 0;
 	}
+}
 
-	uint32_t todo = cam4_rd->fh_size;
+/*
+ * The frame may skip the packed copy when nobody wants the raw samples:
+ * no raw dump, recording or file output.  8 bit frames gain nothing.
+ */
+static int frame_fusable(cam4_rd_t *cam4_rd, frame_slot_t *fs)
+{
+	unsigned	fmt = cam4_rd->FH.fsize >> 28;
 
-	cam4_rd->done = 0;
+	fs->group = cam4_lut_group(fmt, &fs->gpix);
 
-	/* first FH - allocate space */
-	if(cam4_rd->buff_fd[0] == NULL ) {
-		cam4_rd->used_buf_space = todo * 16 / (8+2*(FH->fsize>>28));
+	return cam4_rd->fused_lut && fmt && fs->group &&
+		cam4_rd->fd_size &&
+		cam4_rd->raw_video_writing == VIDEO_WRITE_NONE &&
+		cam4_rd->dumpraw_time.tv_sec == 0 &&
+		!(cam4_rd->start_mode & (f_flag | s_flag));
+}
 
-		cam4_rd->buff_img   = malloc(todo * 8 / (8+2*(FH->fsize>>28)));
-		if(posix_memalign((void **)&(cam4_rd->buff_fd[0]),16,cam4_rd->used_buf_space)
-			|| posix_memalign((void **)&(cam4_rd->buff_fd[1]),16,cam4_rd->used_buf_space))
-		{
-		    ETRACEP("[%s] [err] cannot allocate space for frame. errno: ", __func__);
-		    exit(-1);
-		}
+/* the fill slot starts a new frame */
+static void frame_begin(cam4_rd_t *cam4_rd)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+
+	fs->size	= cam4_rd->fh_size;
+	fs->psize	= cam4_rd->FH.fsize & 0xfffffff;
+	fs->frag	= 0;
+	fs->have	= 0;
+	fs->nranges	= 0;
+	fs->bytes	= 0;
+	fs->next	= 0;
+	fs->irregular	= 0;
+	fs->fused	= frame_fusable(cam4_rd, fs);
+	fs->t_first	= 0;
+	fs->t_last	= 0;
+	fs->partial	= 0;
+	fs->nmissing	= 0;
+
+	/* a fused frame goes through one curve, however it changes meanwhile */
+	if(fs->fused)
+		fs->lut = cam4_lut_hold(CAM4_LUT_FMT(cam4_rd->FH.fsize, cam4_rd->FH.osize));
+
+	if(cam4_rd->fd_size)
+		frame_cover_init(fs, cam4_rd->fd_size);
+
+	cam4_rd->fill_open	= 1;
+	cam4_rd->fill_deadline	= cam4_rd->rx_us + cam4_rd->deadline_us;
+}
 
-		TRACEPNF(0, "[%s] Allocated [%d] bytes\n", __func__, cam4_rd->used_buf_space);
+/* every byte of the frame arrived */
+static inline int frame_full(frame_slot_t *fs)
+{
+	if(fs->irregular || !fs->frag)
+		return fs->bytes >= fs->size;
 
+	return fs->have == fs->bits;
+}
 
-		/* make signal handler */
-		int rc;
-		struct sigaction        actions = { };
+static inline int frame_covered(frame_slot_t *fs, unsigned k)
+{
+	return fs->cover[k >> 5] & (1u << (k & 31));
+}
 
-		sigemptyset(&actions.sa_mask);
-		actions.sa_flags = 0;
-		actions.sa_handler = sighand;
+/*
+ * Irregular frame: [offs, end) arrived, merged into the sorted ranges.
+ * Returns the bytes of it not covered before.
+ */
+static uint32_t frame_range_add(frame_slot_t *fs, uint32_t offs, uint32_t end)
+{
+	frame_run_t	*r = fs->ranges;
+	uint32_t	o = offs, e = end, had = 0, rs, re;
+	unsigned	i, j, n = fs->nranges;
+
+	/* ranges i .. j - 1 overlap or touch [offs, end) */
+	for(i = 0; i < n && r[i].start + r[i].count < offs; i++)
+		;
+	for(j = i; j < n && r[j].start <= end; j++) {
+		rs = r[j].start;
+		re = rs + r[j].count;
+		if(re > offs && rs < end)
+			had += (re < end ? re : end) - (rs > offs ? rs : offs);
+		if(rs < o)
+			o = rs;
+		if(re > e)
+			e = re;
+	}
 
-		rc = sigaction(SIGRTMIN ,&actions, NULL);
-		if( rc < 0 ) {
-		    ETRACEP("Cannot create signal handler. errno ") ;
-		    exit(-1) ;
+	if(i == j) {
+		if(n == fs->ranges_alloc) {
+			r = realloc(fs->ranges, (n ? 2 * n : 16) * sizeof(*r));
+			if(!r)
+				return end - offs;
+			fs->ranges = r;
+			fs->ranges_alloc = n ? 2 * n : 16;
 		}
-		TRACEPNF(0, "Activate signal handler \n");
-
-		cam4_rd->idx = 0 ;
-		int res;
-
-		if( cam4_rd->start_mode & (f_flag | s_flag)) {
+		memmove(r + i + 1, r + i, (n - i) * sizeof(*r));
+		fs->nranges++;
+	} else {
+		memmove(r + i + 1, r + j, (n - j) * sizeof(*r));
+		fs->nranges -= j - i - 1;
+	}
 
-		    TRACE_LINE();
+	r[i].start = o;
+	r[i].count = e - o;
+	return end - offs - had;
+}
 
-		    if( cam4_rd->start_mode & f_flag ) {
-			/* need to prepare output file */
-			cam4_rd->fd = open(cam4_rd->f_name, O_CREAT | O_WRONLY, W_OK|R_OK);
-			if(cam4_rd->fd < 0) {
-			    ETRACE("[err] cannot open file [%s]. errno ", cam4_rd->f_name);
-			    exit(-1);
-			}
-		    }
-		    CREATE_THREAD(res, cam4_rd_dump_buf, cam4_rd, cam4_rd->dump_thread);
+/* the frame left the grid: what the grid covered so far becomes ranges */
+static void frame_irregular(frame_slot_t *fs)
+{
+	unsigned	k, e;
+	uint32_t	end;
 
-		} else {
-		    CREATE_THREAD(res, cam4_rd_process, cam4_rd, cam4_rd->dump_thread);
-		}
+	fs->irregular	= 1;
+	fs->nranges	= 0;
 
-		if( res < 0 ) {
-		    ETRACE("Thread error. errno ");
-		    exit(-1);
-		}
+	for(k = 0; k < fs->bits && fs->have; k = e) {
+		e = k + 1;
+		if(!frame_covered(fs, k))
+			continue;
 
-		TRACEP(0, "Thread started \n");
+		while(e < fs->bits && frame_covered(fs, e))
+			e++;
 
-		dump_hex((uint8_t *)ptr, sizeof(video_frame_raw_hdr_t));
+		end = e * fs->frag;
+		frame_range_add(fs, k * fs->frag, end < fs->size ? end : fs->size);
+	}
+}
 
-		return 0;
-	} else {
-		if (cam4_rd->clear_buff)
-			memset(cam4_rd->buff_fd[cam4_rd->idx ^ 1], 0, cam4_rd->used_buf_space);
+/* FD payload [offs, offs + size) of the fill slot arrived */
+static void frame_cover(cam4_rd_t *cam4_rd, uint32_t offs, unsigned size)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+	unsigned	k;
+
+	if(!fs->bytes)
+		fs->t_first = cam4_rd->rx_us;
+	fs->t_last = cam4_rd->rx_us;
+
+	/* every FD but the tail one has the stream fragment size */
+	if(offs + size != fs->size) {
+		cam4_rd->fd_size = size;
+		if(fs->frag != size && !fs->have && !fs->irregular)
+			frame_cover_init(fs, size);
 	}
 
-	/* new packet > old buff = reallocate */
-	if( cam4_rd->used_buf_space < todo ) {
-	    TRACEP(0, "[%s] we need more space: alloc:%08x req:%08x\n", __func__, cam4_rd->used_buf_space, todo);
+	if(!fs->irregular &&
+	    (!fs->frag || offs % fs->frag || (size != fs->frag && offs + size != fs->size)))
+		frame_irregular(fs);
 
-	    TRACEP(0, "FH: \n");
-	    dump_hex((uint8_t *)ptr, sizeof(video_frame_raw_hdr_t));
-	    exit(-1);
+	/* a repeated FD covers nothing new */
+	if(fs->irregular) {
+		fs->bytes += frame_range_add(fs, offs, offs + size);
+		return;
 	}
 
-	/* put frame into output (file, screen, etc) */
-	if( cam4_rd->start_mode & frame_done_flag ) {
-	    /* old frame already wrote */
-	    cam4_rd->start_mode &= ~(frame_done_flag);
-	    cam4_rd->idx ^= 1;
-	    pthread_kill(cam4_rd->dump_thread, SIGRTMIN);
+	k = offs / fs->frag;
+	if(!frame_covered(fs, k)) {
+		fs->cover[k >> 5] |= 1u << (k & 31);
+		fs->have++;
+		fs->bytes += size;
+	}
+}
 
-	    cam4_rd->w = FH->x_dim;
-            cam4_rd->h = FH->y_dim;
+/* buf bytes [offs, offs + len) of the fill slot, same is 0 if prev differs */
+static void frame_fill(cam4_rd_t *cam4_rd, uint32_t offs, uint32_t len, int same)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+	frame_slot_t	*prev = cam4_rd->prev;
+
+	if(cam4_rd->fill_missing == FILL_PREV && same && prev && prev != fs && prev->size == fs->size &&
+	    prev->FH.x_dim == fs->FH.x_dim)
+		memcpy(fs->buf + offs, prev->buf + offs, len);
+	else if(cam4_rd->fill_missing != FILL_NONE)
+		memset(fs->buf + offs, 0, len);
+}
 
-	    lag = 0;
-	} else {
-	    lag++;
+/* fill [offs, offs + len) of the fill slot that never arrived */
+static void frame_repair(cam4_rd_t *cam4_rd, uint32_t offs, uint32_t len)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+	frame_slot_t	*prev = cam4_rd->prev;
+	int		same = prev && prev->fused == fs->fused && prev->group == fs->group;
+	uint32_t	end = offs + len, pend, po, pe;
+
+	/* fused: the pixels of every group the hole touches */
+	if(fs->fused && offs < fs->psize) {
+		pend	= end < fs->psize ? end : fs->psize;
+		po	= offs / fs->group;
+		pe	= (pend + fs->group - 1) / fs->group;
+		if(pe > fs->psize / fs->group)
+			pe = fs->psize / fs->group;
+
+		if(po < pe)
+			frame_fill(cam4_rd, po * fs->gpix, (pe - po) * fs->gpix, same);
+
+		/* OOB is raw in any frame */
+		offs = pend;
+		same = 1;
 	}
 
-	return 0;
+	if(offs < end)
+		frame_fill(cam4_rd, offs, end - offs, same);
 }
 
-/* copy data into local buffer */
-static inline int cam4_rd_read_fd(void *ptr, cam4_rd_t *cam4_rd)
+/* the group at fragment boundary k is staged: decode it once both sides came */
+static void frame_edge(cam4_rd_t *cam4_rd, unsigned k)
 {
-	video_frame_raw_t		*pFD = ptr;
-	video_frame_raw_hdr_t		*pFH = &cam4_rd->FH;
+	frame_slot_t	*fs = cam4_rd->fill;
+	uint32_t	g = k * fs->frag / fs->group;
 
-	cam4_rd->pFD = pFD;
-	pFD->size = ntohs(pFD->size);
+	if(!k || k >= fs->bits || !frame_covered(fs, k - 1) || !frame_covered(fs, k))
+		return;
+
+	if((g + 1) * fs->group <= fs->psize)
+		cam4_rd_LUT_span(fs->buf + g * fs->gpix, fs->edge + k * fs->group,
+			fs->group, CAM4_LUT_FMT(cam4_rd->FH.fsize, cam4_rd->FH.osize), fs->lut);
+}
+
+/*
+ * Fused FD payload [offs, offs + size) of the fill slot: whole groups go
+ * through the LUT into their pixels, the cut ones at both ends are staged.
+ */
+static void frame_fuse(cam4_rd_t *cam4_rd, const uint8_t *data, uint32_t offs, unsigned size)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+	unsigned	G = fs->group;
+	unsigned	fmt = CAM4_LUT_FMT(cam4_rd->FH.fsize, cam4_rd->FH.osize);
+	uint32_t	end = offs + size, pend, a, b, k;
+
+	frame_cover(cam4_rd, offs, size);
+
+	/* regridded to a fragment smaller than a group */
+	if(!fs->fused) {
+		memcpy(fs->buf + offs, data, size);
+		return;
+	}
+
+	if(end > fs->psize) {
+		a = offs > fs->psize ? offs : fs->psize;
+		memcpy(fs->buf + a, data + (a - offs), end - a);
+		if(offs >= fs->psize)
+			return;
+	}
+
+	pend	= end < fs->psize ? end : fs->psize;
+	a	= (offs + G - 1) / G * G;
+	b	= pend / G * G;
+	if(a < b)
+		cam4_rd_LUT_span(fs->buf + a / G * fs->gpix, data + (a - offs), b - a, fmt, fs->lut);
+
+	/* irregular frames keep their cut groups undecoded */
+	if(fs->irregular)
+		return;
+
+	k = offs / fs->frag;
+	if(offs % G) {
+		memcpy(fs->edge + k * G + offs % G, data, (a < pend ? a : pend) - offs);
+		frame_edge(cam4_rd, k);
+	}
+
+	if(end == pend && end % G && b >= offs && k + 1 < fs->bits) {
+		memcpy(fs->edge + (k + 1) * G, data + (b - offs), end - b);
+		frame_edge(cam4_rd, k + 1);
+	}
+}
+
+/* bytes [offs, end) of the fill slot never arrived */
+static void frame_missing(frame_slot_t *fs, uint32_t offs, uint32_t end)
+{
+	frame_run_t	*r;
+
+	/* out of runs: the last one grows over the rest */
+	if(fs->nmissing == FRAME_MISSING_RUNS) {
+		r = &fs->missing[FRAME_MISSING_RUNS - 1];
+		r->count = end - r->start;
+		return;
+	}
+
+	r = &fs->missing[fs->nmissing++];
+	r->start = offs;
+	r->count = end - offs;
+}
+
+/*
+ * The frame is over: count what is missing in the fill slot and, if asked
+ * to and it is kept, fill only those parts.  Irregular frames have their
+ * holes between the covered ranges.
+ */
+static void frame_complete(cam4_rd_t *cam4_rd, int keep)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+	unsigned	fill = keep ? cam4_rd->fill_missing : FILL_NONE;
+	unsigned	k, e, missing = 0;
+	uint32_t	offs, end, bytes = 0;
+
+	if(fs->irregular || !fs->frag) {
+		if(fs->bytes >= fs->size)
+			return;
+
+		fd_missed(cam4_rd, fs->size - fs->bytes);
+		TRACEPNF(0, "WARN: Frame %08x: %u of %u bytes\n", fs->FH.fseq, fs->bytes, fs->size);
+
+		/* the holes before, between and after the covered ranges */
+		offs = 0;
+		for(k = 0; k <= fs->nranges; k++) {
+			end = k < fs->nranges ? fs->ranges[k].start : fs->size;
+			if(offs < end) {
+				if(fill != FILL_NONE)
+					frame_repair(cam4_rd, offs, end - offs);
+				frame_missing(fs, offs, end);
+			}
+			if(k < fs->nranges)
+				offs = end + fs->ranges[k].count;
+		}
+
+		if(fill != FILL_NONE)
+			cam4_rd->stats.frames_repaired++;
+		return;
+	}
+
+	if(fs->have == fs->bits)
+		return;
+
+	for(k = 0; k < fs->bits; k = e) {
+		/* skip complete words */
+		if(!(k & 31) && fs->cover[k >> 5] == ~0u) {
+			e = k + 32;
+			continue;
+		}
+
+		e = k + 1;
+		if(frame_covered(fs, k))
+			continue;
+
+		/* run of missing fragments */
+		while(e < fs->bits && !frame_covered(fs, e))
+			e++;
+
+		offs	= k * fs->frag;
+		end	= e * fs->frag;
+		if(end > fs->size)
+			end = fs->size;
+
+		if(fill != FILL_NONE)
+			frame_repair(cam4_rd, offs, end - offs);
+		frame_missing(fs, offs, end);
+		missing	+= e - k;
+		bytes	+= end - offs;
+	}
+
+	cam4_rd->frame_fd_missing	+= missing;
+	cam4_rd->stats.fd_missing	+= missing;
+	cam4_rd->stats.fd_missing_bytes	+= bytes;
+	if(fill != FILL_NONE)
+		cam4_rd->stats.frames_repaired++;
+
+	TRACEPNF(0, "WARN: Frame %08x: %u fragments (%u bytes) missing%s\n",
+		fs->FH.fseq, missing, bytes,
+		!keep ? ", dropped" :
+		fill == FILL_PREV ? ", filled from the previous frame" :
+		fill == FILL_ZERO ? ", zeroed" : "");
+}
+
+/* the fill frame is over: account what is missing and hand it over or drop it */
+static void frame_close(cam4_rd_t *cam4_rd, int deliver)
+{
+	frame_slot_t	*fs = cam4_rd->fill;
+
+	/* the frame being filled keeps its own header */
+	fs->FH = cam4_rd->FH;
+	frame_complete(cam4_rd, deliver);
+	fs->partial = !frame_full(fs);
+
+	/* keep last frame data header */
+	if(cam4_rd->pFD)
+		memcpy(&fs->fdata_h, cam4_rd->pFD, sizeof(*cam4_rd->pFD));
+	else
+		fs->fdata_h.flags = 0x4;
+
+	cam4_rd->fill_open = 0;
+	cam4_lut_drop(fs->lut);
+	fs->lut = NULL;
+	if(!deliver)
+		return;
+
+	/* put frame into output (file, screen, etc) */
+	if( !frame_publish(cam4_rd) ) {
+	    cam4_rd->lag = 0;
+	} else {
+	    /* every slot is queued or in work */
+	    cam4_rd->lag++;
+	    cam4_rd->stats.busy_drops++;
+	}
+}
+
+/* -T: the fill frame is over once now passed its deadline */
+static inline void frame_deadline(cam4_rd_t *cam4_rd, uint64_t now)
+{
+	if(!cam4_rd->deadline_us || !cam4_rd->fill_open || now < cam4_rd->fill_deadline)
+		return;
+
+	cam4_rd->stats.deadline_expired++;
+	if(cam4_rd->deadline_drop)
+		cam4_rd->stats.deadline_drops++;
+
+	frame_close(cam4_rd, !cam4_rd->deadline_drop);
+}
+
+static inline int cam4_rd_read_fh(void *ptr, cam4_rd_t *cam4_rd, unsigned len)
+{
+	cam4_rd->part_num++;
+	video_frame_raw_hdr_t *FH  = &cam4_rd->FH;
+	video_frame_raw_hdr_t *src = ptr;
+
+	/* the frame being filled is complete (or lost) now */
+	if(cam4_rd->fill_open)
+		frame_close(cam4_rd, 1);
+
+	/* sensor mode or ROI switched: the buffers follow below */
+	if(cam4_rd->slots && (FH->x_dim != ntohs(src->x_dim) || FH->y_dim != ntohs(src->y_dim) ||
+	    (FH->fsize ^ ntohl(src->fsize)) >> 28))
+		cam4_rd->stats.geometry_changes++;
+
+	FH->lid   = ntohl(src->lid);
+	FH->fseq  = ntohl(src->fseq);
+	FH->gid   = src->gid;
+	FH->ts    = filetime_to_host(&src->ts);
+	FH->x_dim = ntohs(src->x_dim);
+	FH->y_dim = ntohs(src->y_dim);
+	FH->fsize = ntohl(src->fsize);
+
+	if(len >= sizeof(video_frame_raw_hdr_t))
+		FH->osize = ntohl(src->osize);
+	else
+		FH->osize = 0;
+
+	/* previous frame is complete (or lost) now */
+	cam4_rd->stats.frames++;
+	cam4_rd->stats.last_fd_missing	= cam4_rd->frame_fd_missing;
+	cam4_rd->frame_fd_missing	= 0;
+
+	cam4_rd->fh_size	= (FH->fsize&0xfffffff) + (FH->osize&0xfffffff);
+	cam4_rd->bits		= 8+2*(FH->fsize>>28);
+
+	TRACEPNF(0, "LID:%08x SEQ: %08x SZ:%8d@%016"PRIx64" %2dbit cm:%02x %5d x %5d oob:%5d lag:%d\n",
+	    FH->lid,
+	    FH->fseq,
+	    cam4_rd->fh_size,
+	    FH->ts,
+	    cam4_rd->bits,
+	    cam4_rd->pFD ? cam4_rd->FD.flags : 0x4,
+	    FH->x_dim,
+	    FH->y_dim,
+	    (FH->osize&0xfffffff),
+	    cam4_rd->lag
+	);
+
+	if((FH->lid &0xff) == 0x09)
+		cam4_rd->part_num--;
+
+	if(FH->fseq !=  cam4_rd->part_num) {
+	    TRACEPNF(0, "skipped real id = %08x, local id = %08x. Adjust....\n", FH->fseq, cam4_rd->part_num) ;
+	    if((int32_t)(FH->fseq - cam4_rd->part_num) > 0)
+		cam4_rd->stats.fseq_gaps += FH->fseq - cam4_rd->part_num;
+	    cam4_rd->part_num = FH->fseq ;
+	}
+
+	uint32_t todo = cam4_rd->fh_size;
+
+	cam4_rd->done = 0;
+
+	/* first FH - allocate space */
+	if(cam4_rd->slots == NULL ) {
+		if(frame_pool_alloc(cam4_rd, todo))
+		{
+		    ETRACEP("[%s] [err] cannot allocate space for frame. errno: ", __func__);
+		    exit(-1);
+		}
+		frame_begin(cam4_rd);
+
+		int res;
+
+		if( cam4_rd->start_mode & (f_flag | s_flag)) {
+
+		    TRACE_LINE();
+
+		    if( cam4_rd->start_mode & f_flag ) {
+			/* need to prepare output file */
+			cam4_rd->fd = open(cam4_rd->f_name, O_CREAT | O_WRONLY, W_OK|R_OK);
+			if(cam4_rd->fd < 0) {
+			    ETRACE("[err] cannot open file [%s]. errno ", cam4_rd->f_name);
+			    exit(-1);
+			}
+		    }
+		    CREATE_THREAD(res, cam4_rd_dump_buf, cam4_rd, cam4_rd->dump_thread);
+
+		} else {
+		    CREATE_THREAD(res, cam4_rd_process, cam4_rd, cam4_rd->dump_thread);
+		}
+
+		if( res < 0 ) {
+		    ETRACE("Thread error. errno ");
+		    exit(-1);
+		}
+
+		TRACEP(0, "Thread started \n");
+
+		dump_hex((uint8_t *)ptr, sizeof(video_frame_raw_hdr_t));
+
+		return 0;
+	}
+
+	/* larger frame: the fill slot grows, the others when their turn comes */
+	if( frame_reserve(cam4_rd, todo) ) {
+	    ETRACEP("[%s] [err] cannot grow frame %08x to %08x, dropped. errno: ", __func__, FH->fseq, todo);
+	    return 0;
+	}
+
+	frame_begin(cam4_rd);
+
+	return 0;
+}
+
+/* copy data into local buffer */
+static inline int cam4_rd_read_fd(void *ptr, unsigned len, cam4_rd_t *cam4_rd)
+{
+	video_frame_raw_t		*src = ptr;
+	video_frame_raw_t		*pFD = &cam4_rd->FD;
+	video_frame_raw_hdr_t		*pFH = &cam4_rd->FH;
+
+	/* FD size is 16 bit: up to a jumbo frame or a reassembled datagram */
+	if(len < sizeof(*src) || ntohs(src->size) > len - sizeof(*src)) {
+		cam4_rd->stats.fd_truncated++;
+		return 0;
+	}
+
+	/* the packet stays intact in the ring: the archive writes it later */
+	memcpy(pFD, src, sizeof(*pFD));
+	cam4_rd->pFD = pFD;
+	pFD->size = ntohs(pFD->size);
 	pFD->offs = ntohl(pFD->offs);
 	pFD->offs = pFD->offs & ~(0xf<<28);
+	/* straggler of the frame already handed over */
+	if(((pFH->fseq - pFD->fseq) & 0xff) == 1) {
+		cam4_rd->stats.fd_late++;
+		return 0;
+	}
+
+	/* handed over by -T already, or the FH of its frame was lost */
+	if(!cam4_rd->fill_open) {
+		cam4_rd->stats.fd_orphan++;
+		return 0;
+	}
+
 	if(pFD->fseq !=  (pFH->fseq & 0xff)) {
 		TRACEPNF(0, "WARN: FH MISSED %04x@%06x FD not belong to FH. FH->fseq: %08x FD->fseq: %04x delta: %d %u.%u.%u.%u -> %u.%u.%u.%u\n",
 		    pFD->size,
@@ -2261,43 +2457,238 @@ static inline int cam4_rd_read_fd(void *ptr, cam4_rd_t *cam4_rd)
 		pFH->fseq += (pFD->fseq-pFH->fseq)& 0xff;
 	}
 
-	if(offs_static != pFD->offs) {
-	    TRACEPNF(0, "\tWARN DT:%08x should be:%08x received:%08x\n", pFD->offs - offs_static, offs_static, pFD->offs) ;
-	}
+	/* out of order or a hole: the coverage bitmap sorts it out */
+	if(cam4_rd->fill->next != pFD->offs)
+	    TRACEPNF(1, "\tWARN DT:%08x should be:%08x received:%08x\n", pFD->offs - cam4_rd->fill->next, cam4_rd->fill->next, pFD->offs) ;
 
 	if(cam4_rd->fh_size < pFD->offs + pFD->size) {
 //	    	TRACEP(0, "\tINVALID DATA\n");
 		return 0;
 	}//  .,rflyz-vbybr
 
-	offs_static = pFD->offs + pFD->size;
+	cam4_rd->fill->next = pFD->offs + pFD->size;
+
+	if(cam4_rd->fill->fused) {
+		frame_fuse(cam4_rd, src->data, pFD->offs, pFD->size);
+	} else {
+		memcpy(cam4_rd->fill->buf + pFD->offs, src->data, pFD->size);
+		frame_cover(cam4_rd, pFD->offs, pFD->size);
+	}
 
-	memcpy(cam4_rd->buff_fd[cam4_rd->idx] + pFD->offs, pFD->data, pFD->size);
+	/* -T: no need to wait for the next FH */
+	if(cam4_rd->deadline_us && frame_full(cam4_rd->fill))
+		frame_close(cam4_rd, 1);
 
 	cam4_rd->done += pFD->size;
 
 	return 0;
 }
 
-static inline void parse_packet(uint8_t *data, struct tpacket_hdr *h, cam4_rd_t	*cam4_rd)
+/*
+ * -F: a capture thread feeds a context only holding its rx_lock, taken
+ * on the first packet and kept for the run of packets that follow, so
+ * threads fed by different cameras never wait for each other.
+ */
+static inline void stream_release(connection_t *conn)
+{
+	if(conn->held)
+		pthread_mutex_unlock(&conn->held->rx_lock);
+	conn->held = NULL;
+}
+
+static inline void stream_hold(connection_t *conn, cam4_rd_t *cam4_rd)
+{
+	if(!conn->lock || conn->held == cam4_rd)
+		return;
+
+	stream_release(conn);
+	pthread_mutex_lock(&cam4_rd->rx_lock);
+	conn->held = cam4_rd;
+}
+
+/* context of camera stream idx, cloned from the one taken before capture */
+static cam4_rd_t *stream_new(cam4_rd_t *cam4_rd, unsigned idx)
+{
+	cam4_rd_t	*s = malloc(sizeof(*s));
+
+	if(!s)
+		return NULL;
+
+	*s = *cam4_rd->stream_tmpl;
+	s->streams	= NULL;
+	s->nstreams	= 0;
+	s->max_streams	= 0;
+	s->stream_tmpl	= NULL;
+	s->stream_idx	= idx;
+	pthread_mutex_init(&s->rx_lock, NULL);
+
+	if((s->start_mode & f_flag) &&
+	    snprintf(s->f_name, sizeof(s->f_name), "%s.%u", cam4_rd->stream_tmpl->f_name, idx) >= sizeof(s->f_name)) {
+		TRACEPNF(0, "[err] stream %u: -f %s.%u is too long\n", idx, cam4_rd->stream_tmpl->f_name, idx);
+		free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+/*
+ * Reassembly context of the packet at data from conn->iph: one per
+ * source address and flow id, up to -N of them.  Stream 0 is the
+ * configured camera and flow, the others come in the order they are
+ * first seen.  NULL - the table is full and the packet is dropped.
+ * The socket looks in its own shard first, only a stream new to it
+ * goes to the shared table.
+ */
+static cam4_rd_t *stream_lookup(connection_t *conn, uint8_t *data)
+{
+	cam4_rd_t	*cam4_rd = conn->priv;
+	cam4_rd_t	*s = conn->stream_last;
+	uint32_t	src = conn->iph->ip_src.s_addr;
+	uint32_t	lid;
+	unsigned	i;
+
+	if(cam4_rd->max_streams < 2)
+		return cam4_rd;
+
+	memcpy(&lid, data, sizeof(lid));
+	lid = ntohl(lid) & ~LID_TYPE;
+
+	if(s && s->stream_src == src && s->stream_lid == lid)
+		return s;
+
+	for(i = 0; i < conn->nshard; i++) {
+		s = conn->shard[i];
+		if(s->stream_src == src && s->stream_lid == lid)
+			goto found;
+	}
+
+	/* the shard took the whole table once it was full */
+	if(conn->nshard == cam4_rd->max_streams) {
+		conn->stream_drops++;
+		return NULL;
+	}
+
+	/* -F: the table is shared, a thread waiting for it holds no stream */
+	if(conn->lock) {
+		stream_release(conn);
+		pthread_mutex_lock(conn->lock);
+	}
+
+	for(i = 0; i < cam4_rd->nstreams; i++) {
+		s = cam4_rd->streams[i];
+		if(s->stream_src == src && s->stream_lid == lid)
+			goto shard;
+	}
+
+	s = NULL;
+	if(i < cam4_rd->max_streams)
+		s = stream_new(cam4_rd, i);
+
+	if(!s) {
+		if(i == cam4_rd->max_streams) {
+			memcpy(conn->shard, cam4_rd->streams, i * sizeof(*conn->shard));
+			conn->nshard = i;
+		}
+		conn->stream_drops++;
+		goto out;
+	}
+
+	s->stream_src	= src;
+	s->stream_lid	= lid;
+	cam4_rd->streams[i] = s;
+	/* capture_deadline() walks the table without the lock */
+	__sync_synchronize();
+	cam4_rd->nstreams++;
+
+	TRACEPNF(0, "Stream %u: %u.%u.%u.%u flow %08x\n", s->stream_idx, INET2DIG2(&src), lid);
+
+shard:
+	conn->shard[conn->nshard++] = s;
+out:
+	if(conn->lock)
+		pthread_mutex_unlock(conn->lock);
+	if(!s)
+		return NULL;
+found:
+	conn->stream_last = s;
+	return s;
+}
+
+/* table of -N camera streams, cam4_rd is the configured context and stream 0 */
+static int stream_init(cam4_rd_t *cam4_rd)
+{
+	if(cam4_rd->max_streams < 2)
+		return 0;
+
+	cam4_rd->streams	= calloc(cam4_rd->max_streams, sizeof(*cam4_rd->streams));
+	cam4_rd->stream_tmpl	= malloc(sizeof(*cam4_rd->stream_tmpl));
+	if(!cam4_rd->streams || !cam4_rd->stream_tmpl)
+		return -1;
+
+	*cam4_rd->stream_tmpl = *cam4_rd;
+
+	/* camera control, the scripts and the window title belong to stream 0: its lid is the flow id */
+	cam4_rd->stream_src	= cam4_rd->cam4_cl.conn_ipv4.ip;
+	cam4_rd->stream_lid	= cam4_rd->flow_id;
+	cam4_rd->streams[0]	= cam4_rd;
+	cam4_rd->nstreams	= 1;
+	return 0;
+}
+
+/* wait for the worker of the stream, then drop its shared segments */
+static void stream_shm_free(cam4_rd_t *cam4_rd)
+{
+	int		res;
+	void		*thread_exit = NULL;
+
+	if (cam4_rd->dump_thread)
+		THREAD_JOIN(res, cam4_rd->dump_thread, thread_exit);
+
+	if (cam4_rd->shmid1 != -1) {
+		shmctl(cam4_rd->shmid1, IPC_RMID, NULL);	/* Destroy Region */
+		shmdt(cam4_rd->shmaddr[0]);
+	}
+
+	if (cam4_rd->shmid2 != -1) {
+		shmctl(cam4_rd->shmid2, IPC_RMID, NULL);	/* Destroy Region */
+		shmdt(cam4_rd->shmaddr[1]);
+	}
+
+	if (cam4_rd->shmid3 != -1) {
+	    memset(cam4_rd->shmaddr3, 0, sizeof(common_t));
+	    shmctl(cam4_rd->shmid3, IPC_RMID, NULL);	/* Destroy Region */
+	    shmdt(cam4_rd->shmaddr3);
+	}
+}
+
+static inline void parse_packet(connection_t *conn, uint8_t *data, unsigned len)
 {
+    cam4_rd_t	*cam4_rd;
     uint32_t	lid = (uint32_t)(*data);
     lid = htonl(lid) ;
 
+    if(!(cam4_rd = stream_lookup(conn, data)))
+	return;
+
+    stream_hold(conn, cam4_rd);
+    cam4_rd->iph	= conn->iph;
+    cam4_rd->rx_us	= conn->rx_us;
+
+    frame_deadline(cam4_rd, cam4_rd->rx_us);
+
     switch(lid&LID_TYPE) {
 	case LID_FD:
 
-		if( cam4_rd->buff_fd[0] == NULL ) {
+		if( cam4_rd->slots == NULL ) {
 		    return;
 		}
 
-		cam4_rd_read_fd(data, cam4_rd);
+		cam4_rd_read_fd(data, len, cam4_rd);
 		break;
 
 	case LID_FH:
-		cam4_rd_read_fh(data, cam4_rd, h->tp_snaplen - h->tp_mac - sizeof(struct ip));
-
-		offs_static = 0;
+		cam4_rd_read_fh(data, cam4_rd, len);
 		break;
 
 	default:
@@ -2306,6 +2697,28 @@ static inline void parse_packet(uint8_t *data, struct tpacket_hdr *h, cam4_rd_t
 
 }
 
+/* filter camera video packets out of the captured IP traffic */
+static inline void rx_packet(connection_t *conn, struct ip *iph, unsigned len)
+{
+	cam4_rd_t *cam4_rd = conn->priv;
+	uint8_t *data = (uint8_t *)iph + sizeof(struct ip);
+
+	if(
+	    (iph->ip_id == htons (54321)) &&
+	    (iph->ip_p  == 253)
+	) {
+		/* check for the protocol type */
+		conn->iph = iph;
+		if(
+		    (!cam4_rd->disable_mcast) ||
+		    (iph->ip_dst.s_addr == cam4_rd->cam4_cl.conn_cl.ip) ||
+		    (iph->ip_src.s_addr == cam4_rd->cam4_cl.conn_ipv4.ip)
+		) {
+			parse_packet(conn, data, len - sizeof(struct ip));
+		}
+	}
+}
+
 static void raw_off(cam4_rd_t *cam4_rd, mcast_cl_interface_t *ifs)
 {
 	TRACEPNF(0, "Raw off\n");
@@ -2873,6 +3286,15 @@ int parse_command(FILE* fdstream,cam4_rd_t* cam4_rd) {
 			}
 		return 0;
 	}
+	if (strncmp(buf,"CURVE:",6) == 0) {
+		int res = cam4_lut_command(buf+6);
+
+		if(res == -2)
+			TRACEP(0, "CMD: \"CURVE\" not applied, frames still hold every table: %s", buf+6);
+		else if(res)
+			TRACEP(0, "CMD: \"CURVE\" not understood: %s", buf+6);
+		return 0;
+	}
 	if (strncmp(buf,"REINIT:",7) == 0) {
 		cam4_reinit(cam4_rd);
 		return 0;
@@ -3117,218 +3539,1093 @@ void* process_cm_ifs(void*priv) {
 			TRACEPNF(0,"ERROR poll()\n");
 			return NULL;
 		}
-		if (res == 0)
-			continue;
-		// res > 0
-		if (pfd[0].revents & POLLIN) {
-			parse_command(fdstream,cam4_rd);
+		if (res == 0)
+			continue;
+		// res > 0
+		if (pfd[0].revents & POLLIN) {
+			parse_command(fdstream,cam4_rd);
+
+		}
+		/*
+		if (pfd[0].revents & POLLHUP) {
+			shutdown(s_in, SHUT_RDWR);
+			close(s_in);
+
+			break;
+		}*/
+	}
+
+	return NULL;
+}
+
+
+int find_ifs(mcast_cl_api_t *mcast_cl)
+{
+    int			i, res;
+    mcast_cl_payload_t	*rx_vars = &mcast_cl->rx_vars;
+    cam4_rd_t 		*cam4_rd = (cam4_rd_t *)mcast_cl->priv;
+
+    res = memcmp(&mcast_cl->ipv4_device.sin_addr, &mcast_cl->ipv4_dst.sin_addr, sizeof(typeof(mcast_cl->ipv4_dst.sin_addr)));
+    if( (mcast_cl->cpu_id != rx_vars->cpu_id) && (res != 0) )
+		return -1;
+
+	cam4_rd->device_name = (char*)rx_vars->dev_name.str;
+	TRACEPNF(0,"Device name %s\n",rx_vars->dev_name.str);
+	//cam4_rd->device_name_size = rx_vars->dev_name.size;
+    /* find properly ifs */
+
+    for(i = 1; i < rx_vars->ifs_idx; i++ ) {
+    	mcast_cl_interface_t *ifs = &rx_vars->interface[i];
+
+		if( ifs->type == P3_CM && cam4_rd->first_time) {
+			cam4_rd->first_time = 0;
+			int res;
+			TRACEPNF(0, "Found P3_CM\n");
+			cam4_rd->cm_ifs = ifs;
+			CREATE_THREAD(res, process_cm_ifs, cam4_rd, cam4_rd->cm_thread);
+
+			break;
+		}
+
+    }
+
+    for(i = 1; i < rx_vars->ifs_idx; i++ ) {
+    	mcast_cl_interface_t *ifs = &rx_vars->interface[i];
+		if( ifs->type == P3_DEVICE_BOTH ) {
+			TRACEPNF(0, "Found P3_DEVICE_BOTH\n");
+			res = raw_on(cam4_rd, ifs);
+			return i;
+		}
+
+    } // for(i = 1; i < IFS_NUM_CL; i++ )
+
+    TRACEPNF(0, "[ERR] Cannot find P3_CM interface\n");
+
+    return -1;
+}
+
+void mcast_cl_do_request(mcast_cl_api_t *m)
+{
+	if(!m->ipv4_device.sin_addr.s_addr)
+		return;
+
+	abi_io_task_t	*tw  = &m->tx_task;
+	ssize_t		res;
+
+	/* PING dest */
+	abi_preinit_taskw(
+		tw,
+		m->pfds[0].fd,
+		NULL,
+		1024	/* buff size */
+	);
+
+	abi_writer_task_reset(tw);
+
+	abi_node_t	tmp = { };
+
+	ABI_SET_KEY32(tmp, CONFIG_ABI_GET_STAT_CMD);
+	res = abi_append_node(tw->abi, &tmp);
+	abiw_write(tw->abi, 0);			/* prepare entair PACKET to send */
+
+	m->ipv4_device.sin_port = htons(4521);
+	res = sendto(tw->fd, tw->data, tw->todo, 0, (struct sockaddr*)&m->ipv4_device, (socklen_t)sizeof(m->ipv4_device));
+	if(res != tw->todo) {
+		ETRACE("When send mcast");
+	}
+
+	TRACEPNF(0, "TEST\n");
+}
+
+static int cam4_mcast(cam4_rd_t *cam4_rd)
+{
+    int			res;
+    void		*thread_exit = 0;
+    mcast_cl_api_t	*mcast_cl = &cam4_rd->mcast_cl;
+
+    TRACEPNF(0, "[%s]\n", __func__);
+
+     if( (res=mcast_cl_init(mcast_cl)) < 0)
+	 return -1;
+
+    //mcast_cl->cpu_id = 0xa25d00505a84070eull;		// linux devision
+    //mcast_cl->cpu_id = 0x9ea2ad02bc534713ull;		// yuris
+
+   /* get the actual information */
+    CREATE_THREAD(res, process_cl_mcast, mcast_cl, cam4_rd->mcast_cl_thread);
+
+    THREAD_JOIN(res, cam4_rd->mcast_cl_thread, thread_exit);
+
+    /* clear buffers */
+    mcast_cl_destroy(mcast_cl);
+    return res;
+}
+
+/*
+ * TPACKET_V3 ring geometry: keep `frames` whole video frames of `fsize` octets
+ * (with their FH) in the ring, counting packets by the smallest FD payload
+ * we expect.  The block retire timeout is the wire time of the block share
+ * of one frame, so a half filled block never holds a frame tail for long.
+ */
+static void ring_v3_geometry(struct tpacket_req3 *req, uint32_t fsize, unsigned frames)
+{
+	uint32_t	pkt_len, pkt_num, frame_bytes, frame_blocks, frame_ms, blocks;
+
+	pkt_len = TPACKET_ALIGN(TPACKET3_HDRLEN + sizeof(struct ip) +
+	    sizeof(video_frame_raw_t) + RING_FRAG_PAYLOAD);
+	pkt_num = (fsize + RING_FRAG_PAYLOAD - 1) / RING_FRAG_PAYLOAD + 1;
+	frame_bytes = pkt_num * pkt_len;
+
+	/* one spare block: the kernel may still own a part filled one */
+	blocks = (frame_bytes * frames + RING_V3_BLOCK_SIZE - 1) / RING_V3_BLOCK_SIZE + 1;
+	if(blocks < RING_V3_MIN_BLOCKS)
+		blocks = RING_V3_MIN_BLOCKS;
+
+	frame_blocks = (frame_bytes + RING_V3_BLOCK_SIZE - 1) / RING_V3_BLOCK_SIZE;
+	frame_ms = (uint32_t)((uint64_t)frame_bytes * 8 / (RING_LINK_MBPS * 1000));
+
+	memset(req, 0, sizeof(*req));
+	req->tp_block_size	= RING_V3_BLOCK_SIZE;
+	req->tp_frame_size	= RING_V3_FRAME_SIZE;
+	req->tp_block_nr	= blocks;
+	req->tp_frame_nr	= blocks * (RING_V3_BLOCK_SIZE / RING_V3_FRAME_SIZE);
+	req->tp_retire_blk_tov	= frame_ms / frame_blocks ? frame_ms / frame_blocks : 1;
+}
+
+int connection_free(connection_t* conn);
+
+/* largest IP packet the capture interface can deliver */
+static unsigned link_mtu(int ifindex)
+{
+	struct ifreq	ifr = { };
+	int		sock;
+	unsigned	mtu = RING_JUMBO_MTU;
+
+	if(!ifindex || !if_indextoname(ifindex, ifr.ifr_name))
+		return mtu;
+
+	if( (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return mtu;
+
+	if(!ioctl(sock, SIOCGIFMTU, &ifr))
+		mtu = ifr.ifr_mtu > 0xffff ? 0xffff : ifr.ifr_mtu;
+
+	close(sock);
+	return mtu;
+}
+
+static int ring_setup(connection_t *conn)
+{
+	int	version = TPACKET_V3;
+
+	if(conn->ring_frames) {
+		if(!conn->ring_fsize)
+			conn->ring_fsize = RING_DEFAULT_FSIZE;
+
+		if(!setsockopt(conn->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+			ring_v3_geometry(&conn->req, conn->ring_fsize, conn->ring_frames);
+
+			if(!setsockopt(conn->fd, SOL_PACKET, PACKET_RX_RING,
+				(char *)&(conn->req), sizeof(conn->req))) {
+				conn->version = TPACKET_V3;
+
+				TRACEPNF(0, "TPACKET_V3 ring: %u blocks of %u for %u frames of %u, tov %ums\n",
+					conn->req.tp_block_nr, conn->req.tp_block_size,
+					conn->ring_frames, conn->ring_fsize,
+					conn->req.tp_retire_blk_tov);
+				return 0;
+			}
+		}
+
+		ETRACEP("TPACKET_V3 is not available, fall back to V1. errno ");
+		version = TPACKET_V1;
+		setsockopt(conn->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+	}
+
+	/* Setup the fd for mmap() ring buffer, one slot holds a whole packet */
+	unsigned	slot, need = TPACKET_HDRLEN + link_mtu(conn->ifindex);
+
+	/* reassembled datagrams may be larger than the MTU */
+	if(need < conn->slot_need)
+		need = conn->slot_need;
+
+	for(slot = getpagesize(); slot < need; slot <<= 1)
+		;
+
+	memset(&conn->req, 0, sizeof(conn->req));
+	conn->req.tp_block_size	= slot;
+	conn->req.tp_frame_size	= slot;
+	conn->req.tp_block_nr		= RING_V1_BYTES / slot;
+	conn->req.tp_frame_nr		= RING_V1_BYTES / slot;
+	conn->version			= TPACKET_V1;
+
+	TRACEPNF(0, "TPACKET_V1 ring: %u slots of %u\n", conn->req.tp_frame_nr, slot);
+
+	return setsockopt(conn->fd,
+		SOL_PACKET,
+		PACKET_RX_RING,
+		(char *)&(conn->req),
+		sizeof(struct tpacket_req));
+}
+
+/*
+ * Join the socket to the PACKET_FANOUT group.  A classic BPF program picks
+ * the socket by camera source address + lid, so every fragment of a stream
+ * lands on the same capture thread.  Kernels without CBPF fanout
+ * fall back to the flow hash, which also keeps a camera on one socket.
+ */
+static int fanout_join(connection_t *conn)
+{
+	struct sock_filter	code[] = {
+		BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, offsetof(struct ip, ip_src)),
+		BPF_STMT(BPF_MISC| BPF_TAX,           0),
+		BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, sizeof(struct ip)),	/* lid */
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K,   ~LID_TYPE),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_X,   0),
+		BPF_STMT(BPF_RET | BPF_A,             0),
+	};
+	struct sock_fprog	prog = {
+		.len	= sizeof(code)/sizeof(code[0]),
+		.filter	= code,
+	};
+	int			arg;
+
+	arg = conn->fanout_id | ((PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	if(!setsockopt(conn->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg))) {
+		if(!setsockopt(conn->fd, SOL_PACKET, PACKET_FANOUT_DATA, &prog, sizeof(prog)))
+			return 0;
+
+		/* the group exists already in CBPF mode - nothing else can join */
+		ETRACEP("Cannot set fanout program. errno ");
+		return -1;
+	}
+
+	arg = conn->fanout_id | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	if(setsockopt(conn->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg))) {
+		ETRACEP("Cannot join fanout group %04x. errno ", conn->fanout_id);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Attach a classic BPF program accepting only camera video packets
+ * (ip_id == 54321, ip_p == 253, optionally from conn->src_ip), so the rest
+ * of the host traffic never takes ring slots.  SOCK_DGRAM: offsets are
+ * relative to the IP header.  rx_packet() still checks the same fields,
+ * the filter is an optimization only.
+ */
+static int filter_attach(connection_t *conn)
+{
+	struct sock_filter	code[] = {
+		BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, offsetof(struct ip, ip_id)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   54321, 0, 5),
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, offsetof(struct ip, ip_p)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   253, 0, 3),
+		BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, offsetof(struct ip, ip_src)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ntohl(conn->src_ip), 0, 1),
+		BPF_STMT(BPF_RET | BPF_K,             0xffffffff),
+		BPF_STMT(BPF_RET | BPF_K,             0),
+	};
+	struct sock_fprog	prog = {
+		.len	= sizeof(code)/sizeof(code[0]),
+		.filter	= code,
+	};
+
+	/* any camera: the address compare becomes a no-op jump */
+	if(!conn->src_ip)
+		code[5] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0);
+
+	if(setsockopt(conn->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+		ETRACEP("Cannot attach the camera filter. errno ");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * UDP ingest: FH/FD datagrams as sent by raw_dummy_tx.  No CAP_NET_RAW is
+ * needed; recvmmsg() drains up to UDP_BATCH datagrams per syscall.  Fanout
+ * members share the port via SO_REUSEPORT, the kernel hashes by source so
+ * a camera stays on one socket.
+ */
+static int udp_connection(connection_t *conn)
+{
+	struct sockaddr_in	addr = {
+		.sin_family		= AF_INET,
+		.sin_port		= htons(conn->udp_port),
+		.sin_addr.s_addr	= htonl(INADDR_ANY),
+	};
+	int			i, one = 1, rcvbuf;
+
+	if ( (conn->fd=socket(AF_INET, SOCK_DGRAM, 0))<0 ) {
+		perror("socket()");
+		return 1;
+	}
+
+	/* let the socket queue as much as the V3 ring would */
+	if(!conn->ring_fsize)
+		conn->ring_fsize = RING_DEFAULT_FSIZE;
+	rcvbuf = (conn->ring_frames ? conn->ring_frames : 1) * conn->ring_fsize;
+	if (setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+		setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (conn->fanout_nr > 1 &&
+	    setsockopt(conn->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+		perror("setsockopt(SO_REUSEPORT)");
+		close(conn->fd);
+		conn->fd = -1;
+		return 1;
+	}
+
+	if (bind(conn->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("bind()");
+		close(conn->fd);
+		conn->fd = -1;
+		return 1;
+	}
+
+	if (conn->use_uring) {
+		/* the ring takes the socket over, poll() its fd */
+		conn->uring = uring_sock_open(conn->fd, URING_BUFS, URING_BUF_SIZE);
+		conn->fd = conn->uring ? uring_sock_fd(conn->uring) : -1;
+		return !conn->uring;
+	}
+
+	conn->msgs	= calloc(UDP_BATCH, sizeof(struct mmsghdr));
+	conn->from	= calloc(UDP_BATCH, sizeof(struct sockaddr_in));
+	conn->ring	= calloc(UDP_BATCH, sizeof(struct iovec));
+	conn->slots	= malloc(UDP_BATCH * UDP_SLOT_SIZE);
+	if (!conn->msgs || !conn->from || !conn->ring || !conn->slots) {
+		ETRACEP("Cannot allocate UDP batch. errno ");
+		connection_free(conn);
+		return 1;
+	}
+
+	for (i = 0; i < UDP_BATCH; i++) {
+		conn->ring[i].iov_base	= conn->slots + i * UDP_SLOT_SIZE;
+		conn->ring[i].iov_len	= UDP_SLOT_SIZE;
+
+		conn->msgs[i].msg_hdr.msg_iov		= &conn->ring[i];
+		conn->msgs[i].msg_hdr.msg_iovlen	= 1;
+		conn->msgs[i].msg_hdr.msg_name		= &conn->from[i];
+	}
+
+	socklen_t	len = sizeof(rcvbuf);
+	getsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+	TRACEPNF(0, "UDP ingest on port %u, batch %u, socket buffer %d\n",
+		conn->udp_port, UDP_BATCH, rcvbuf);
+	return 0;
+}
+
+/*
+ * AF_XDP: frames of one interface queue go to the UMEM before the kernel
+ * IP stack sees them.  The UMEM holds -R video frames worth of packets.
+ */
+static int xdp_connection(connection_t *conn)
+{
+	unsigned	packets;
+
+	if(!conn->ring_fsize)
+		conn->ring_fsize = RING_DEFAULT_FSIZE;
+	packets = (conn->ring_frames ? conn->ring_frames : 1) *
+		(conn->ring_fsize / RING_FRAG_PAYLOAD + 1);
+
+	conn->xdp = xdp_sock_open(conn->xdp_ifname, conn->xdp_queue, packets);
+	if(!conn->xdp)
+		return 1;
+
+	conn->fd = xdp_sock_fd(conn->xdp);
+	return 0;
+}
+
+/* index of the interface holding addr, 0 if none */
+static int ifindex_by_addr(in_addr_t addr)
+{
+	char		buf[4096];
+	struct ifconf	ifc = {
+		.ifc_len	= sizeof(buf),
+		.ifc_buf	= buf,
+	};
+	int		sock, i, idx = 0;
+
+	if( (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return 0;
+
+	if(!ioctl(sock, SIOCGIFCONF, &ifc)) {
+		for(i = 0; i < ifc.ifc_len / sizeof(struct ifreq); i++) {
+			struct ifreq *item = &ifc.ifc_req[i];
+
+			if(((struct sockaddr_in *)&item->ifr_addr)->sin_addr.s_addr == addr) {
+				idx = if_nametoindex(item->ifr_name);
+				TRACEPNF(0, "Capture on %s (%d)\n", item->ifr_name, idx);
+				break;
+			}
+		}
+	}
+
+	close(sock);
+	return idx;
+}
+
+/* ring entries go back to the kernel from the archive writer */
+static void ring_release_v1(void *entry)
+{
+	((struct tpacket_hdr *)entry)->tp_status = TP_STATUS_KERNEL;
+}
+
+static void ring_release_v3(void *entry)
+{
+	((struct tpacket_block_desc *)entry)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+}
+
+/* one archive per capture socket, it survives ring resizes */
+static int archive_open(connection_t *conn)
+{
+	char		path[PATH_MAX];
+
+	if(conn->fanout_nr > 1)
+		snprintf(path, sizeof(path), "%s-%u", conn->pcap_path, conn->fanout_idx);
+	else
+		snprintf(path, sizeof(path), "%s", conn->pcap_path);
+
+	conn->pcap = pcap_arch_open(path, conn->pcap_mb,
+		conn->version == TPACKET_V3 ? ring_release_v3 : ring_release_v1);
+
+	return conn->pcap ? 0 : -1;
+}
+
+static void archive_close(connection_t *conn)
+{
+	pcap_arch_close(conn->pcap);
+	conn->pcap = NULL;
+}
+
+int create_connection(connection_t* conn) {
+	unsigned	ring_nr, ring_sz;
+
+	if (conn->udp_port)
+		return udp_connection(conn);
+
+	if (conn->xdp_ifname)
+		return xdp_connection(conn);
+
+	if ( (conn->fd=socket(PF_PACKET, SOCK_DGRAM, 0))<0 ) {
+		perror("socket()");
+		return 1;
+	}
+
+	if ( ring_setup(conn) != 0 ) {
+		perror("setsockopt()");
+		close(conn->fd);
+		return 1;
+	};
+
+	/* mmap() the sucker */
+	conn->map=mmap(NULL,
+		conn->req.tp_block_size * conn->req.tp_block_nr,
+		PROT_READ|PROT_WRITE, MAP_SHARED, conn->fd, 0);
+
+	if ( conn->map==MAP_FAILED ) {
+		perror("mmap()");
+		close(conn->fd);
+		return 1;
+	}
+
+	/* Setup our ringbuffer */
+	if(conn->version == TPACKET_V3) {
+		ring_nr = conn->req.tp_block_nr;
+		ring_sz = conn->req.tp_block_size;
+	} else {
+		ring_nr = conn->req.tp_frame_nr;
+		ring_sz = conn->req.tp_frame_size;
+	}
+
+	if(conn->pcap_path && !conn->pcap && archive_open(conn)) {
+		munmap(conn->map, conn->req.tp_block_size * conn->req.tp_block_nr);
+		conn->map = NULL;
+		close(conn->fd);
+		conn->fd = -1;
+		return 1;
+	}
+
+	conn->ring=malloc(ring_nr * sizeof(struct iovec));
+	conn->cur = 0;
+	int i;
+	for(i=0; i<ring_nr; i++) {
+		conn->ring[i].iov_base=(void *)((long)conn->map)+(i*ring_sz);
+		conn->ring[i].iov_len=ring_sz;
+	}
+
+// ++++++++++++++++++++++++++++++++++++++++++
+	/* bind the packet socket */
+	struct sockaddr_ll	addr = {
+	    .sll_family		= AF_PACKET,
+	    .sll_protocol	= htons(ETH_P_IP),
+	    .sll_ifindex	= conn->ifindex,
+	    .sll_hatype		= 0,
+	    .sll_pkttype	= 0,
+	    .sll_halen		= 0,
+	};
+
+	if(filter_attach(conn)) {
+		connection_free(conn);
+		return 1;
+	}
+
+	if(bind(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) ) {
+		munmap(conn->map, conn->req.tp_block_size * conn->req.tp_block_nr);
+		perror("bind()");
+		close(conn->fd);
+		return 1;
+	}
+
+	/*
+	 * Even a single socket joins a fanout group: PACKET_FANOUT_FLAG_DEFRAG
+	 * is the only way to get IP-fragmented video datagrams reassembled
+	 * before they reach a packet socket.
+	 */
+	if(fanout_join(conn) && conn->fanout_nr > 1) {
+		connection_free(conn);
+		return 1;
+	}
+	return 0;
+}
+/* packets dropped by a datagram socket for lack of buffer space */
+static uint64_t socket_drops(int fd)
+{
+	uint32_t	mem[SK_MEMINFO_VARS];
+	socklen_t	len = sizeof(mem);
+
+	if(fd < 0 || getsockopt(fd, SOL_SOCKET, SO_MEMINFO, mem, &len))
+		return 0;
+
+	return mem[SK_MEMINFO_DROPS];
+}
+
+/* refresh the kernel side counters of one capture socket */
+static void connection_stats(connection_t *conn)
+{
+	union {
+		struct tpacket_stats	v1;
+		struct tpacket_stats_v3	v3;
+	} st;
+	socklen_t len=sizeof(st);
+
+	if (conn->xdp) {
+		xdp_sock_stats(conn->xdp, &conn->rx_packets, &conn->rx_drops);
+	} else if (conn->uring) {
+		uring_sock_stats(conn->uring, &conn->rx_packets, &conn->rx_drops);
+	} else if (conn->udp_port) {
+		conn->rx_packets = conn->udp_packets;
+		conn->rx_drops	 = socket_drops(conn->fd);
+	} else if (conn->fd >= 0 &&
+		   !getsockopt(conn->fd,SOL_PACKET,PACKET_STATISTICS,(char *)&st,&len)) {
+		conn->rx_packets += st.v1.tp_packets;
+		conn->rx_drops	 += st.v1.tp_drops;
+
+		if (conn->version == TPACKET_V3)
+			conn->rx_freezes += st.v3.tp_freeze_q_cnt;
+	}
+}
+
+int connection_free(connection_t* conn) {
+
+	if (conn->fd >= 0) {
+		connection_stats(conn);
+
+		TRACE(0, "recieved %"PRIu64" packets, dropped %"PRIu64", truncated %"PRIu64"\n",
+			conn->rx_packets, conn->rx_drops, conn->rx_truncated);
+
+		if (conn->version == TPACKET_V3 && !conn->udp_port && !conn->xdp)
+			TRACE(0, "queue freezes %"PRIu64"\n", conn->rx_freezes);
+
+		if (conn->udp_calls)
+			TRACE(0, "%"PRIu64" recvmmsg calls\n", conn->udp_calls);
+	}
+
+	if (conn->xdp) {
+		xdp_sock_close(conn->xdp);
+		conn->xdp = NULL;
+		conn->fd = -1;
+	} else if (conn->uring) {
+		uring_sock_close(conn->uring);
+		conn->uring = NULL;
+		conn->fd = -1;
+	}
+
+	/* the archive writer still reads the ring and hands entries back */
+	if (conn->pcap && conn->map)
+		pcap_arch_flush(conn->pcap);
+
+	if (conn->map) {
+		munmap(conn->map, conn->req.tp_block_size * conn->req.tp_block_nr);
+		conn->map = NULL;
+	}
+
+	if ( conn->fd>=0 ) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+
+	if (conn->ring) {
+		free(conn->ring);
+		conn->ring = NULL;
+	}
+
+	free(conn->msgs);
+	free(conn->from);
+	free(conn->slots);
+	conn->msgs	= NULL;
+	conn->from	= NULL;
+	conn->slots	= NULL;
+	return 0;
+}
+
+/*
+ * Slots held by the archive writer keep their status, so they would look
+ * fresh again once the walk wraps around: stop when all of them are held.
+ */
+static inline int ring_all_held(connection_t *conn, unsigned ring_nr)
+{
+	return conn->pcap && pcap_arch_held(conn->pcap) >= ring_nr;
+}
+
+/* queue the V1 slot to the archive, the writer releases it */
+static void archive_v1(connection_t *conn, struct tpacket_hdr *h)
+{
+	struct sockaddr_ll	*sll = (void *)((uint8_t *)h + TPACKET_ALIGN(sizeof(*h)));
+
+	if(pcap_arch_room(conn->pcap) < 1 + conn->req.tp_frame_nr) {
+		pcap_arch_drop(conn->pcap, 1);
+		pcap_arch_packet(conn->pcap, NULL, 0, 0, 0, 0, NULL, h);
+		return;
+	}
+
+	pcap_arch_packet(conn->pcap, (uint8_t *)h + h->tp_mac, h->tp_snaplen, h->tp_len,
+		h->tp_sec, h->tp_usec, sll->sll_addr, h);
+}
+
+/* queue every packet of the V3 block, the writer releases the block */
+static void archive_v3(connection_t *conn, struct tpacket_block_desc *pbd)
+{
+	struct tpacket3_hdr	*h;
+	struct sockaddr_ll	*sll;
+	unsigned		n, nr = pbd->hdr.bh1.num_pkts;
+
+	/* room for the releases of every other block is kept */
+	if(pcap_arch_room(conn->pcap) < nr + 1 + conn->req.tp_block_nr) {
+		pcap_arch_drop(conn->pcap, nr);
+		nr = 0;
+	}
+
+	h = (struct tpacket3_hdr *)((uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+
+	for(n = 0; n < nr; n++) {
+		sll = (void *)((uint8_t *)h + TPACKET_ALIGN(sizeof(*h)));
+
+		pcap_arch_packet(conn->pcap, (uint8_t *)h + h->tp_mac, h->tp_snaplen, h->tp_len,
+			h->tp_sec, h->tp_nsec / 1000, sll->sll_addr, n == nr - 1 ? pbd : NULL);
+		h = (struct tpacket3_hdr *)((uint8_t *)h + h->tp_next_offset);
+	}
+
+	if(!nr)
+		pcap_arch_packet(conn->pcap, NULL, 0, 0, 0, 0, NULL, pbd);
+}
+
+/* walk the V1 ring: one packet per frame slot */
+static void capture_ring_v1(connection_t *conn)
+{
+	unsigned	i = conn->cur;
+
+	while(*(unsigned long*)conn->ring[i].iov_base && !ring_all_held(conn, conn->req.tp_frame_nr)) {
+		struct tpacket_hdr *h = conn->ring[i].iov_base;
+		struct	ip *iph = (struct ip *)((unsigned char *)h + h->tp_mac) ;
+
+		if(h->tp_snaplen < h->tp_len) {
+			conn->rx_truncated++;
+			if(conn->slot_need < TPACKET_HDRLEN + h->tp_len)
+				conn->slot_need = TPACKET_HDRLEN + h->tp_len;
+		} else {
+			conn->rx_us = h->tp_sec * 1000000ull + h->tp_usec;
+			rx_packet(conn, iph, h->tp_snaplen);
+		}
+
+		/* tell the kernel this packet is done with */
+		if(conn->pcap)
+			archive_v1(conn, h);
+		else
+			h->tp_status=0;
+		//mb(); /* memory barrier */
+
+		i = (i==conn->req.tp_frame_nr-1) ? 0 : i+1;
+	}
+
+	conn->cur = i;
+}
+
+/* walk the V3 ring: blocks of packets retired by the kernel */
+static void capture_ring_v3(connection_t *conn)
+{
+	struct tpacket_block_desc	*pbd;
+	struct tpacket3_hdr		*h;
+	unsigned			n;
+
+	for(;;) {
+		pbd = conn->ring[conn->cur].iov_base;
+
+		if(!(pbd->hdr.bh1.block_status & TP_STATUS_USER) || ring_all_held(conn, conn->req.tp_block_nr))
+			break;
+
+		h = (struct tpacket3_hdr *)((uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+
+		for(n = 0; n < pbd->hdr.bh1.num_pkts; n++) {
+			if(h->tp_snaplen < h->tp_len)
+				conn->rx_truncated++;
+			else {
+				/* the block may wait for its retire, the packet time does not */
+				conn->rx_us = h->tp_sec * 1000000ull + h->tp_nsec / 1000;
+				rx_packet(conn, (struct ip *)((uint8_t *)h + h->tp_mac), h->tp_snaplen);
+			}
+			h = (struct tpacket3_hdr *)((uint8_t *)h + h->tp_next_offset);
+		}
 
+		/* give the whole block back */
+		if(conn->pcap)
+			archive_v3(conn, pbd);
+		else {
+			__sync_synchronize();
+			pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
 		}
-		/*
-		if (pfd[0].revents & POLLHUP) {
-			shutdown(s_in, SHUT_RDWR);
-			close(s_in);
 
-			break;
-		}*/
+		conn->cur = (conn->cur == conn->req.tp_block_nr - 1) ? 0 : conn->cur + 1;
 	}
-
-	return NULL;
 }
 
-
-int find_ifs(mcast_cl_api_t *mcast_cl)
+/* one datagram from the UDP socket */
+static inline void udp_rx(connection_t *conn, struct sockaddr_in *from, uint8_t *data, unsigned len)
 {
-    int			i, res;
-    mcast_cl_payload_t	*rx_vars = &mcast_cl->rx_vars;
-    cam4_rd_t 		*cam4_rd = (cam4_rd_t *)mcast_cl->priv;
+	cam4_rd_t	*cam4_rd = conn->priv;
 
-    res = memcmp(&mcast_cl->ipv4_device.sin_addr, &mcast_cl->ipv4_dst.sin_addr, sizeof(typeof(mcast_cl->ipv4_dst.sin_addr)));
-    if( (mcast_cl->cpu_id != rx_vars->cpu_id) && (res != 0) )
-		return -1;
+	if(conn->src_ip && from->sin_addr.s_addr != conn->src_ip)
+		return;
 
-	cam4_rd->device_name = (char*)rx_vars->dev_name.str;
-	TRACEPNF(0,"Device name %s\n",rx_vars->dev_name.str);
-	//cam4_rd->device_name_size = rx_vars->dev_name.size;
-    /* find properly ifs */
+	conn->udp_iph.ip_src	= from->sin_addr;
+	conn->udp_iph.ip_dst.s_addr = cam4_rd->cam4_cl.conn_cl.ip;
+	conn->iph = &conn->udp_iph;
 
-    for(i = 1; i < rx_vars->ifs_idx; i++ ) {
-    	mcast_cl_interface_t *ifs = &rx_vars->interface[i];
+	parse_packet(conn, data, len);
+}
 
-		if( ifs->type == P3_CM && cam4_rd->first_time) {
-			cam4_rd->first_time = 0;
-			int res;
-			TRACEPNF(0, "Found P3_CM\n");
-			cam4_rd->cm_ifs = ifs;
-			CREATE_THREAD(res, process_cm_ifs, cam4_rd, cam4_rd->cm_thread);
+/* drain the UDP socket, UDP_BATCH datagrams per call */
+static void capture_udp(connection_t *conn)
+{
+	int		i, n;
 
-			break;
-		}
+	do {
+		for(i = 0; i < UDP_BATCH; i++)
+			conn->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
 
-    }
+		n = recvmmsg(conn->fd, conn->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if(n <= 0)
+			break;
 
-    for(i = 1; i < rx_vars->ifs_idx; i++ ) {
-    	mcast_cl_interface_t *ifs = &rx_vars->interface[i];
-		if( ifs->type == P3_DEVICE_BOTH ) {
-			TRACEPNF(0, "Found P3_DEVICE_BOTH\n");
-			res = raw_on(cam4_rd, ifs);
-			return i;
-		}
+		conn->udp_calls++;
+		conn->udp_packets += n;
 
-    } // for(i = 1; i < IFS_NUM_CL; i++ )
+		for(i = 0; i < n; i++)
+			udp_rx(conn, &conn->from[i],
+				conn->ring[i].iov_base, conn->msgs[i].msg_len);
+	} while(n == UDP_BATCH);
+}
 
-    TRACEPNF(0, "[ERR] Cannot find P3_CM interface\n");
+static void uring_rx(void *priv, struct sockaddr_in *from, uint8_t *data, unsigned len)
+{
+	connection_t	*conn = priv;
 
-    return -1;
+	udp_rx(conn, from, data, len);
 }
 
-void mcast_cl_do_request(mcast_cl_api_t *m)
+/* AF_XDP delivers whole Ethernet frames, of any camera the XDP program matched */
+static void xdp_rx(void *priv, uint8_t *pkt, unsigned len)
 {
-	if(!m->ipv4_device.sin_addr.s_addr)
+	connection_t	*conn = priv;
+	struct ip	*iph = (struct ip *)(pkt + ETH_HLEN);
+
+	if(len < ETH_HLEN + sizeof(struct ip))
 		return;
 
-	abi_io_task_t	*tw  = &m->tx_task;
-	ssize_t		res;
+	if(conn->src_ip && iph->ip_src.s_addr != conn->src_ip)
+		return;
 
-	/* PING dest */
-	abi_preinit_taskw(
-		tw,
-		m->pfds[0].fd,
-		NULL,
-		1024	/* buff size */
-	);
+	/* the program passes fragments up the stack, nothing reassembles them here */
+	if(iph->ip_off & htons(IP_MF | IP_OFFMASK))
+		return;
 
-	abi_writer_task_reset(tw);
+	rx_packet(conn, iph, len - ETH_HLEN);
+}
 
-	abi_node_t	tmp = { };
+/* -T: the deadline of one stream, unless another thread feeds it right now and checks it itself */
+static inline void stream_deadline(connection_t *conn, cam4_rd_t *cam4_rd, uint64_t now)
+{
+	if(!conn->lock) {
+		frame_deadline(cam4_rd, now);
+	} else if(!pthread_mutex_trylock(&cam4_rd->rx_lock)) {
+		frame_deadline(cam4_rd, now);
+		pthread_mutex_unlock(&cam4_rd->rx_lock);
+	}
+}
 
-	ABI_SET_KEY32(tmp, CONFIG_ABI_GET_STAT_CMD);
-	res = abi_append_node(tw->abi, &tmp);
-	abiw_write(tw->abi, 0);			/* prepare entair PACKET to send */
+/* -T: frames whose fragments stopped coming, checked after every pass */
+static void capture_deadline(connection_t *conn, cam4_rd_t *cam4_rd)
+{
+	uint64_t	now = time_us();
+	unsigned	n;
 
-	m->ipv4_device.sin_port = htons(4521);
-	res = sendto(tw->fd, tw->data, tw->todo, 0, (struct sockaddr*)&m->ipv4_device, (socklen_t)sizeof(m->ipv4_device));
-	if(res != tw->todo) {
-		ETRACE("When send mcast");
-	}
+	/* packets of a V3 block not retired yet are older than they look */
+	if(!conn->udp_port && !conn->xdp && conn->version == TPACKET_V3)
+		now -= conn->req.tp_retire_blk_tov * 1000ull;
 
-	TRACEPNF(0, "TEST\n");
+	stream_deadline(conn, cam4_rd, now);
+	for(n = 1; n < cam4_rd->nstreams; n++)
+		stream_deadline(conn, cam4_rd->streams[n], now);
 }
 
-static int cam4_mcast(cam4_rd_t *cam4_rd)
+/* how long to sleep in poll() when no packet comes: -T overshoots by a quarter at most */
+static inline int capture_poll_ms(cam4_rd_t *cam4_rd)
 {
-    int			res;
-    void		*thread_exit = 0;
-    mcast_cl_api_t	*mcast_cl = &cam4_rd->mcast_cl;
+	if(!cam4_rd->deadline_us || cam4_rd->deadline_us >= 4000000)
+		return 1000;
 
-    TRACEPNF(0, "[%s]\n", __func__);
+	return cam4_rd->deadline_us >= 4000 ? cam4_rd->deadline_us / 4000 : 1;
+}
 
-     if( (res=mcast_cl_init(mcast_cl)) < 0)
-	 return -1;
+static void capture_ring(connection_t *conn, cam4_rd_t *cam4_rd)
+{
+	/* no packet time stamps off the packet ring: the time of this pass */
+	conn->rx_us = time_us();
+
+	if(conn->xdp) {
+		while(xdp_sock_rx(conn->xdp, xdp_rx, conn))
+			;
+	} else if(conn->uring) {
+		while(uring_sock_rx(conn->uring, uring_rx, conn))
+			;
+	} else if(conn->udp_port)
+		capture_udp(conn);
+	else if(conn->version == TPACKET_V3)
+		capture_ring_v3(conn);
+	else
+		capture_ring_v1(conn);
 
-    //mcast_cl->cpu_id = 0xa25d00505a84070eull;		// linux devision
-    //mcast_cl->cpu_id = 0x9ea2ad02bc534713ull;		// yuris
+	stream_release(conn);
 
-   /* get the actual information */
-    CREATE_THREAD(res, process_cl_mcast, mcast_cl, cam4_rd->mcast_cl_thread);
+	if(cam4_rd->deadline_us)
+		capture_deadline(conn, cam4_rd);
+}
 
-    THREAD_JOIN(res, cam4_rd->mcast_cl_thread, thread_exit);
+/* capture_stats() reads the sockets of the other threads meanwhile */
+static int ring_rebuild(connection_t *conn, uint32_t fsize)
+{
+	int		res;
 
-    /* clear buffers */
-    mcast_cl_destroy(mcast_cl);
-    return res;
+	if(conn->lock)
+		pthread_mutex_lock(conn->lock);
+
+	connection_free(conn);
+	if(fsize)
+		conn->ring_fsize = fsize;
+	res = create_connection(conn);
+
+	if(conn->lock)
+		pthread_mutex_unlock(conn->lock);
+	return res;
 }
 
-int create_connection(connection_t* conn) {
-	if ( (conn->fd=socket(PF_PACKET, SOCK_DGRAM, 0))<0 ) {
-		perror("socket()");
-		return 1;
+/* announced frame or a reassembled datagram does not fit the ring - size it up */
+static int ring_fit_frame(connection_t *conn, cam4_rd_t *cam4_rd)
+{
+	if(conn->udp_port || conn->xdp)
+		return 0;
+
+	/* V1: a datagram did not fit the slot - rebuild with larger slots */
+	if(conn->version == TPACKET_V1) {
+		if(conn->slot_need <= conn->req.tp_frame_size)
+			return 0;
+
+		TRACEPNF(0, "Packet of %u does not fit ring slot of %u. Resize...\n",
+			conn->slot_need, conn->req.tp_frame_size);
+
+		return ring_rebuild(conn, 0);
 	}
 
-	/* Setup the fd for mmap() ring buffer */
-	conn->req.tp_block_size	= 8192;
-	conn->req.tp_frame_size	= 8192;
-	conn->req.tp_block_nr		= 2000;
-	conn->req.tp_frame_nr		= 1*2000;
+	if(cam4_rd->fh_size <= conn->ring_fsize)
+		return 0;
 
-	if ( (setsockopt(conn->fd,
-		SOL_PACKET,
-		PACKET_RX_RING,
-		(char *)&(conn->req),
-		sizeof(conn->req))) != 0 ) {
-		perror("setsockopt()");
-		close(conn->fd);
-		return 1;
-	};
+	TRACEPNF(0, "Frame %u does not fit ring sized for %u. Resize...\n",
+		cam4_rd->fh_size, conn->ring_fsize);
 
-	/* mmap() the sucker */
-	conn->map=mmap(NULL,
-		conn->req.tp_block_size * conn->req.tp_block_nr,
-		PROT_READ|PROT_WRITE|PROT_EXEC, MAP_SHARED, conn->fd, 0);
+	return ring_rebuild(conn, cam4_rd->fh_size);
+}
 
-	if ( conn->map==MAP_FAILED ) {
-		perror("mmap()");
-		close(conn->fd);
-		return 1;
-	}
+/*
+ * Sum the counters of every capture socket into cam4_rd->stats and
+ * publish them to the shared segment, at most once a second.  The
+ * other camera streams get the socket counters next to their own.
+ */
+static void capture_stats(connection_t *conn, cam4_rd_t *cam4_rd)
+{
+	static time_t		last;
+	capture_stats_t		sum = {};
+	struct timeval		now;
+	int			i;
+	unsigned		n;
+
+	gettimeofday(&now, NULL);
+	if(now.tv_sec == last)
+		return;
+	last = now.tv_sec;
 
-	/* Setup our ringbuffer */
-	conn->ring=malloc(conn->req.tp_frame_nr * sizeof(struct iovec));
-	int i;
-	for(i=0; i<conn->req.tp_frame_nr; i++) {
-		conn->ring[i].iov_base=(void *)((long)conn->map)+(i*conn->req.tp_frame_size);
-		conn->ring[i].iov_len=conn->req.tp_frame_size;
+	/* the fanout threads may rebuild their sockets and grow the table */
+	if(conn->lock)
+		pthread_mutex_lock(conn->lock);
+
+	for(i = 0; i < (conn->fanout_nr > 1 ? conn->fanout_nr : 1); i++) {
+		connection_t	*c = i ? &fanout_conn[i] : conn;
+
+		if(i && !c->priv)
+			continue;
+
+		connection_stats(c);
+		sum.rx_packets		+= c->rx_packets;
+		sum.kernel_drops	+= c->rx_drops;
+		sum.queue_freezes	+= c->rx_freezes;
+		sum.slot_truncated	+= c->rx_truncated;
+		sum.stream_drops	+= c->stream_drops;
+
+		if(c->pcap) {
+			uint64_t	packets, bytes, drops;
+
+			pcap_arch_stats(c->pcap, &packets, &bytes, &drops);
+			sum.archive_packets	+= packets;
+			sum.archive_drops	+= drops;
+		}
 	}
 
-// ++++++++++++++++++++++++++++++++++++++++++
-	/* bind the packet socket */
-	struct sockaddr_ll	addr = {
-	    .sll_family		= AF_PACKET,
-	    .sll_protocol	= htons(ETH_P_IP),
-	    .sll_ifindex	= 0,	/* eth0 FIXME - need detect ifs ID via ioctl(). 0 - any ifs */
-	    .sll_hatype		= 0,
-	    .sll_pkttype	= 0,
-	    .sll_halen		= 0,
-	};
+	/* the counters of a stream are its feeding thread's */
+	for(n = 0; n < (cam4_rd->nstreams ? cam4_rd->nstreams : 1); n++) {
+		cam4_rd_t	*s = n ? cam4_rd->streams[n] : cam4_rd;
 
-	if(bind(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) ) {
-		munmap(conn->map, conn->req.tp_block_size * conn->req.tp_block_nr);
-		perror("bind()");
-		close(conn->fd);
-		return 1;
+		if(conn->lock)
+			pthread_mutex_lock(&s->rx_lock);
+
+		s->stats.rx_packets		= sum.rx_packets;
+		s->stats.kernel_drops		= sum.kernel_drops;
+		s->stats.queue_freezes		= sum.queue_freezes;
+		s->stats.slot_truncated		= sum.slot_truncated;
+		s->stats.archive_packets	= sum.archive_packets;
+		s->stats.archive_drops		= sum.archive_drops;
+		s->stats.stream_drops		= sum.stream_drops;
+		s->stats.seq++;
+
+		if(s->common)
+			shm_publish(&s->common->capture, &s->stats, sizeof(s->stats));
+
+		if(conn->lock)
+			pthread_mutex_unlock(&s->rx_lock);
 	}
-	return 0;
+
+	if(conn->lock)
+		pthread_mutex_unlock(conn->lock);
 }
-int connection_free(connection_t* conn) {
 
-	struct tpacket_stats st;
-	socklen_t len=sizeof(st);
+/* capture thread of one socket in the fanout group */
+static void *capture_thread(void *priv)
+{
+	connection_t	*conn	 = priv;
+	cam4_rd_t	*cam4_rd = conn->priv;
+	struct pollfd	pfd;
 
-	if (!getsockopt(conn->fd,SOL_PACKET,PACKET_STATISTICS,(char *)&st,&len))
-		TRACE(0, "recieved %u packets, dropped %u\n",
-			st.tp_packets, st.tp_drops);
+	while(no_sig_exit) {
+		capture_ring(conn, cam4_rd);
 
-	if (conn->map)
-		munmap(conn->map, conn->req.tp_block_size * conn->req.tp_block_nr);
+		if(ring_fit_frame(conn, cam4_rd))
+			break;
 
-	if ( conn->fd>=0 ) {
-		close(conn->fd);
-		conn->fd = -1;
+		pfd.fd		= conn->fd;
+		pfd.events	= POLLIN|POLLERR;
+		pfd.revents	= 0;
+		poll(&pfd, 1, capture_poll_ms(cam4_rd));
 	}
 
-	if (conn->ring) {
-		free(conn->ring);
-		conn->ring = NULL;
+	return NULL;
+}
+
+/* open the rest of the fanout group, conn is the first member */
+static int fanout_start(connection_t *conn, cam4_rd_t *cam4_rd)
+{
+	int		i, res;
+
+	for(i = 1; i < conn->fanout_nr; i++) {
+		connection_t	*c = &fanout_conn[i];
+
+		c->fd		= -1;
+		c->ring_frames	= conn->ring_frames;
+		c->ring_fsize	= conn->ring_fsize;
+		c->fanout_nr	= conn->fanout_nr;
+		c->fanout_id	= conn->fanout_id;
+		c->lock		= conn->lock;
+		c->src_ip	= conn->src_ip;
+		c->ifindex	= conn->ifindex;
+		c->udp_port	= conn->udp_port;
+		c->use_uring	= conn->use_uring;
+		c->pcap_path	= conn->pcap_path;
+		c->pcap_mb	= conn->pcap_mb;
+		c->fanout_idx	= i;
+
+		if(create_connection(c))
+			return -1;
+
+		c->priv		= cam4_rd;
+
+		CREATE_THREAD(res, capture_thread, c, c->thread);
+		if(res) {
+			connection_free(c);
+			return -1;
+		}
 	}
+
+	TRACEPNF(0, "Fanout group %04x: %u capture sockets\n", conn->fanout_id, conn->fanout_nr);
 	return 0;
 }
 
+static void fanout_stop(connection_t *conn)
+{
+	int		i, res;
+	void		*thread_exit = NULL;
+
+	for(i = 1; i < conn->fanout_nr; i++) {
+		connection_t	*c = &fanout_conn[i];
+
+		if(!c->priv)
+			continue;
+
+		if(c->thread)
+			THREAD_JOIN(res, c->thread, thread_exit);
+		connection_free(c);
+		archive_close(c);
+	}
+}
+
 int cam4_ps_main(int argc, char **argv)
 {
 	struct pollfd 		pfd[2];
 	int 			i,k;
 	char			val_str[255] = "";
 	char			dst_str[255] = "";
+	int			any_src = 0;
 
 	cam4_rd_t	cam4_rd = {
 		.mcast_cl.no_sig_exit	= &no_sig_exit,
@@ -3338,6 +4635,7 @@ int cam4_ps_main(int argc, char **argv)
 		.mcast_cl.find_dev	= &find_ifs,
 
 		.flow_id		= CAM4_RAW_IFS,
+		.rx_lock		= PTHREAD_MUTEX_INITIALIZER,
 
 
 		.video_writing		= VIDEO_WRITE_NONE,
@@ -3352,27 +4650,37 @@ int cam4_ps_main(int argc, char **argv)
 		.xvWidth		= 0,
 		.xvHeight		= 0,
 
+		.shmid1			= -1,
+		.shmid2			= -1,
+		.shmid3			= -1,
+
 		.common			= NULL,
 
-		.clear_buff		= 0,
+		.fill_missing		= FILL_NONE,
 		.disable_mcast		= 0,
+
+		.nslots			= FRAME_SLOTS_DEFAULT,
 	};
 
 	default_debayer_api.debayerRGB_func[0] = debayerRGB_fast_mode0;
 	default_debayer_api.debayerRGB_func[1] = debayerRGB_ar_mode1; //debayerRGB_fast_mode1;
 	default_debayer_api.debayerRGB_func[2] = debayerRGB_fast_mode2;
 	default_debayer_api.debayerRGB_func[3] = debayerRGB_fast_mode3;
+	default_debayer_api.name = "scalar";
 
 	cam4_cmd_cl_t	*cam4_cl = &cam4_rd.cam4_cl;
 
 	cam4_cl->no_sig_exit = &no_sig_exit;
+
+	conn.fd			= -1;
+	conn.ring_frames	= RING_DEFAULT_FRAMES;
 	I = stdout ;
 
 	signal(SIGINT, sigproc);
 
 	/* FIXME - add bayer phase */
 	/* parse parameters */
-	while ((i = getopt(argc, argv, "ZC:bD:d:f:g:hm:n:sv:zMp:q")) != -1) {
+	while ((i = getopt(argc, argv, "ZC:bD:d:f:g:hm:n:sv:zyLMp:qR:F:AU:X:IP:B:N:T:J:")) != -1) {
 		TRACE(3, "mode %c\n", i);
 
 		switch (i) {
@@ -3415,8 +4723,23 @@ int cam4_ps_main(int argc, char **argv)
 			cam4_rd.write_cb = &write_frame;
 			break;
 			case 'z':
-				/*clear buffer*/
-			cam4_rd.clear_buff = 1;
+				/* zero the missing parts of a frame */
+			cam4_rd.fill_missing = FILL_ZERO;
+			break;
+		    case 'y':
+			/* missing parts of a frame from the previous one */
+			cam4_rd.fill_missing = FILL_PREV;
+			break;
+		    case 'L':
+			/* no packed frame copy */
+			cam4_rd.fused_lut = 1;
+			break;
+		    case 'J':
+			/* LUT stripes */
+			if(cam4_lut_threads(strtoul(optarg, (char **)NULL, 0))) {
+			    ETRACEP("Cannot start LUT threads. errno ");
+			    return -1;
+			}
 			break;
 		    case 'm':
 			/* file presented */
@@ -3460,6 +4783,76 @@ int cam4_ps_main(int argc, char **argv)
 		    case 'q':
 			quad = 1;
 			break;
+		    case 'R':
+			/* frames to buffer in the capture ring */
+			conn.ring_frames = strtoul(optarg, (char **)NULL, 0);
+			break;
+		    case 'B':
+			/* frame pool between the receiver and the worker */
+			cam4_rd.nslots = strtoul(optarg, (char **)NULL, 0);
+			break;
+		    case 'N':
+			/* camera streams reassembled side by side */
+			cam4_rd.max_streams = strtoul(optarg, (char **)NULL, 0);
+			if(cam4_rd.max_streams > STREAMS_MAX) {
+			    TRACEP(0, "=========== [ERR] -N is limited to %d.\n", STREAMS_MAX);
+			    return -1;
+			}
+			break;
+		    case 'F':
+			/* capture sockets in the fanout group */
+			conn.fanout_nr = strtoul(optarg, (char **)NULL, 0);
+			if(conn.fanout_nr > FANOUT_MAX) {
+			    TRACEP(0, "=========== [ERR] -F is limited to %d.\n", FANOUT_MAX);
+			    return -1;
+			}
+			break;
+		    case 'A':
+			/* no interface binding, no camera address filter */
+			any_src = 1;
+			break;
+		    case 'U':
+			/* UDP ingest port */
+			conn.udp_port = strtoul(optarg, (char **)NULL, 0);
+			break;
+		    case 'I':
+			/* io_uring for the UDP socket */
+			conn.use_uring = 1;
+			break;
+		    case 'X': {
+			/* AF_XDP interface and queue */
+			char	*q = strchr(optarg, ':');
+
+			if(q) {
+				*q++ = 0;
+				conn.xdp_queue = strtoul(q, (char **)NULL, 0);
+			}
+			conn.xdp_ifname = optarg;
+			break;
+		    }
+		    case 'T': {
+			/* frame completion deadline, partial frames dropped with :drop */
+			char	*mode = strchr(optarg, ':');
+
+			if(mode) {
+				*mode++ = 0;
+				cam4_rd.deadline_drop = !strcmp(mode, "drop");
+			}
+			cam4_rd.deadline_us = strtoul(optarg, (char **)NULL, 0) * 1000ull;
+			break;
+		    }
+		    case 'P': {
+			/* packet archive and its rotation size */
+			char	*sz = strchr(optarg, ':');
+
+			conn.pcap_mb = 1024;
+			if(sz) {
+				*sz++ = 0;
+				conn.pcap_mb = strtoul(sz, (char **)NULL, 0);
+			}
+			conn.pcap_path = optarg;
+			break;
+		    }
 
 		    case 'h':
 		    default:
@@ -3553,6 +4946,27 @@ int cam4_ps_main(int argc, char **argv)
 	    return -1;
 	}
 
+	if(conn.use_uring && !conn.udp_port) {
+	    TRACEP(0, "=========== [ERR] -I needs -U.\n");
+	    return -1;
+	}
+
+	if(conn.xdp_ifname && (conn.udp_port || conn.fanout_nr > 1)) {
+	    TRACEP(0, "=========== [ERR] -X cannot be used with -U or -F.\n");
+	    return -1;
+	}
+
+	/* jumbo frames and reassembled datagrams are the packet socket's only */
+	if(conn.xdp_ifname && link_mtu(if_nametoindex(conn.xdp_ifname)) > XDP_MTU_MAX) {
+	    TRACEP(0, "=========== [ERR] -X %s: MTU %u is larger than a UMEM chunk takes (%u), capture without -X.\n",
+		conn.xdp_ifname, link_mtu(if_nametoindex(conn.xdp_ifname)), XDP_MTU_MAX);
+	    return -1;
+	}
+
+	if(conn.pcap_path && (conn.udp_port || conn.xdp_ifname)) {
+	    TRACEP(0, "=========== [ERR] -P archives from the packet ring, it cannot be used with -U or -X.\n");
+	    return -1;
+	}
 
 	/* let's fly */
 	TRACEP(0, "Ready-Steady-GOOOOOOOOOOOOO \n") ;
@@ -3588,9 +5002,34 @@ int cam4_ps_main(int argc, char **argv)
 		goto finish;
 	}
 
-	conn.fd = -1;
+	/*
+	 * camera address is known now (-v or the mcast answer): listen only
+	 * on the interface of the client address and only to that camera
+	 */
+	if (!any_src) {
+		conn.src_ip	= cam4_cl->conn_ipv4.ip;
+		conn.ifindex	= ifindex_by_addr(cam4_cl->conn_cl.ip);
+	}
+
+	/* -N: the other cameras on the interface are streams of their own */
+	if (cam4_rd.max_streams > 1)
+		conn.src_ip	= 0;
+
+	conn.fanout_id	= getpid() & 0xffff;
+	conn.priv	= &cam4_rd;
+	if (conn.fanout_nr > 1)
+		conn.lock	= &fanout_lock;
+
+	if (stream_init(&cam4_rd)) {
+		ETRACEP("[%s] [err] cannot allocate the stream table. errno: ", __func__);
+		return -1;
+	}
+
 	if (create_connection(&conn))
 		return 0;
+
+	if (conn.fanout_nr > 1 && fanout_start(&conn, &cam4_rd))
+		goto finish;
 // ++++++++++++++++++++++++++++++++++++++++++
 
 #if 0
@@ -3602,50 +5041,21 @@ int cam4_ps_main(int argc, char **argv)
 	}
 #endif
 
-	i = 0;
 	gettimeofday(&(cam4_rd.last_time),NULL);
 	while(no_sig_exit) {
-		while(*(unsigned long*)conn.ring[i].iov_base) {
-			//printf("a");
-			struct tpacket_hdr *h = conn.ring[i].iov_base;
-			//struct sockaddr_ll *sll=(void *)h + TPACKET_ALIGN(sizeof(*h));
-			//unsigned char *bp=(unsigned char *)h + h->tp_mac;
-			struct	ip *iph = (struct ip *)((unsigned char *)h + h->tp_mac) ;
-			uint8_t *data = (uint8_t *)iph + sizeof(struct ip);
-/*
-			TRACE(90, "%u.%.6u: if%u %s %u bytes\n",
-				h->tp_sec, h->tp_usec,
-				addr.sll_ifindex,
-				names[addr.sll_pkttype],
-				h->tp_len
-			);
-*/
-			if(
-			    (iph->ip_id == htons (54321)) &&
-			    (iph->ip_p  == 253)
-			) {
-				/* check for the protocol type */
-				cam4_rd.iph = iph;
-				if(
-				    (!cam4_rd.disable_mcast) ||
-				    (iph->ip_dst.s_addr == cam4_rd.cam4_cl.conn_cl.ip) ||
-				    (iph->ip_src.s_addr == cam4_rd.cam4_cl.conn_ipv4.ip)
-				) {
-					parse_packet(data, h, &cam4_rd);
-				}
-			}
-			/* tell the kernel this packet is done with */
-			h->tp_status=0;
-			//mb(); /* memory barrier */
+		capture_ring(&conn, &cam4_rd);
 
-			i = (i==conn.req.tp_frame_nr-1) ? 0 : i+1;
-		}
+		if (ring_fit_frame(&conn, &cam4_rd))
+			break;
 
 		/* Sleep when nothings happening */
 		pfd[0].fd=conn.fd;
 		pfd[0].events=POLLIN|POLLERR;
 		pfd[0].revents=0;
-		poll(pfd, 1, 1000);
+		poll(pfd, 1, capture_poll_ms(&cam4_rd));
+
+		capture_stats(&conn, &cam4_rd);
+
 		if (cam4_rd.mcast_reinit) {
 			cam4_rd.mcast_reinit = 0;
 
@@ -3659,22 +5069,14 @@ finish:
 	raw_off(&cam4_rd, NULL);
 
 	TRACE_FLUSH();
+	no_sig_exit = 0;
+	fanout_stop(&conn);
 	connection_free(&conn);
-	if (shmid1 != -1) {
-		shmctl(shmid1, IPC_RMID, NULL);	/* Destroy Region */
-		shmdt(shmaddr[0]);
-	}
-
-	if (shmid2 != -1) {
-		shmctl(shmid2, IPC_RMID, NULL);	/* Destroy Region */
-		shmdt(shmaddr[1]);
-	}
+	archive_close(&conn);
 
-	if (shmid3 != -1) {
-	    memset(shmaddr3, 0, sizeof(common_t));
-	    shmctl(shmid3, IPC_RMID, NULL);	/* Destroy Region */
-	    shmdt(shmaddr3);
-	}
+	stream_shm_free(&cam4_rd);
+	for (i = 1; i < cam4_rd.nstreams; i++)
+		stream_shm_free(cam4_rd.streams[i]);
 
 	return 0;
 }
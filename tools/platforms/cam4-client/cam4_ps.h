@@ -27,6 +27,7 @@
 \*/
 
 #include <inttypes.h>
+#include <semaphore.h>
 
 #include <abi/ip-video-raw.h>
 #include "cam4-cmd-cl.h"
@@ -44,6 +45,63 @@ enum video_write{
 
 struct cam4_rd_s;
 
+/* one reassembled frame, passed from the receiver to the worker */
+typedef struct {
+	uint8_t				*buf;
+	uint32_t			alloc;		/* buf bytes */
+	video_frame_raw_hdr_t		FH;		/* header of the frame in buf */
+	video_frame_raw_t		fdata_h;	/* last data header of the frame */
+
+	/*
+	 * Fragment coverage: bit k is set when the FD at k * frag arrived,
+	 * so fragments may come in any order.  A frame whose fragments do
+	 * not sit on that grid is irregular and keeps sorted byte ranges
+	 * instead.  For a partial frame handed over by the -T deadline the
+	 * clear bits, or the gaps between the ranges, are the missing
+	 * regions.  A repeated FD covers nothing new and adds no bytes.
+	 */
+	uint32_t			size;		/* frame bytes */
+	uint32_t			*cover;
+	unsigned			cover_words;	/* allocated */
+	unsigned			frag;		/* 0 - not known yet */
+	unsigned			bits;		/* fragments in the frame */
+	unsigned			have;		/* bits set */
+	frame_run_t			*ranges;	/* irregular: covered bytes */
+	unsigned			nranges;
+	unsigned			ranges_alloc;
+	uint32_t			bytes;		/* FD payload covered */
+	uint32_t			next;		/* offset expected next */
+	int				irregular;
+	int				partial;	/* handed over incomplete */
+	unsigned			nmissing;
+	frame_run_t			missing[FRAME_MISSING_RUNS];	/* bytes of size */
+
+	/*
+	 * Fused LUT (-L): the fragments are decoded into 8 bit pixels as they
+	 * come, buf never holds the packed samples.  A packed group cut by
+	 * the fragment boundary k waits in edge + k * group until both of
+	 * its fragments are there.  The OOB data past psize stays raw.
+	 */
+	int				fused;
+	uint32_t			psize;		/* packed sample bytes */
+	unsigned			group;		/* packed group bytes */
+	unsigned			gpix;		/* pixels in a group */
+	uint8_t				*edge;
+	unsigned			edge_size;	/* allocated */
+	cam4_lut_table_t		*lut;		/* held from the FH to the end */
+
+	/* arrival of the first and the last FD, us of the host clock */
+	uint64_t			t_first;
+	uint64_t			t_last;
+} frame_slot_t;
+
+/* what goes into the parts of a frame that never arrived */
+enum frame_fill {
+	FILL_NONE,					/* stale slot data */
+	FILL_ZERO,
+	FILL_PREV,					/* the previous frame */
+};
+
 typedef int write_cb_f(struct cam4_rd_s *);
 typedef struct cam4_rd_s {
 	uint16_t			start_mode;
@@ -55,21 +113,49 @@ typedef struct cam4_rd_s {
 	write_cb_f			*write_cb;
 	uint8_t				*img;
 	uint8_t				*buff_img;
-	uint8_t				*buff_fd[2];
-	video_frame_raw_t		fdata_h[2];
-	uint8_t 			clear_buff;
-	uint32_t			used_buf_space;
+	uint16_t			*img16;
+	size_t				img_size;	/* bytes of buff_img and img16 */
+
+	/*
+	 * Frame pool: the receiver fills one slot and publishes it, the
+	 * worker takes published slots in order.  head/tail count frames,
+	 * each side writes only its own counter.
+	 */
+	frame_slot_t			*slots;
+	unsigned			nslots;
+	volatile unsigned		slot_head;	/* frames published */
+	volatile unsigned		slot_tail;	/* frames done by the worker */
+	sem_t				slot_ready;
+	unsigned			fill_idx;	/* receiver side */
+	unsigned			work_idx;	/* worker side */
+	frame_slot_t			*fill;		/* being reassembled */
+	frame_slot_t			*work;		/* being processed */
+	frame_slot_t			*prev;		/* last published */
+	int				fill_open;	/* FH came, frame not closed yet */
+
+	/*
+	 * Completion deadline (-T): a frame is handed over as soon as all of
+	 * it arrived, or deadline_us after its FH, complete or not.
+	 */
+	uint64_t			deadline_us;	/* 0 - on the next FH */
+	uint64_t			fill_deadline;
+	uint8_t				deadline_drop;	/* discard partial frames */
+
+	uint8_t 			fill_missing;	/* enum frame_fill */
+	uint8_t				fused_lut;	/* LUT straight from the fragments */
 	int				fd;
 
 	/* buffer */
 	uint8_t				buff_fh[65536];
 	video_frame_raw_hdr_t		FH;
-	video_frame_raw_t		*pFD;
+	video_frame_raw_t		FD;		/* last data header, host order */
+	video_frame_raw_t		*pFD;		/* &FD once a data header came */
 
 	uint32_t			done;
+	uint32_t			part_num;	/* expected fseq */
+	unsigned			lag;		/* frames dropped in a row */
 
 	pthread_t			dump_thread;
-	uint8_t				idx;
 
 
 	/* mcast stuff */
@@ -107,6 +193,11 @@ typedef struct cam4_rd_s {
 	int				xvWidth;
 
 	common_t*			common;
+	uint8_t*			shmaddr[2];	/* yuv double buffer */
+	uint8_t*			shmaddr3;	/* common */
+	int				shmid1;
+	int				shmid2;
+	int				shmid3;
 
 	int				raw_video_fd;
 	avi_rwh_t			*avi;
@@ -137,8 +228,37 @@ typedef struct cam4_rd_s {
 	uint32_t 		    	expo;
 
 	debayer_api_t			d_api;
+	/* debayer kernel bound to the frame and window it was resolved for */
+	_debayerRGB_func		*d_func;
+	const char			*d_name;
+	int				d_geom[7];	/* dim_x dim_y startx starty ww wh mode */
+
+	/* -F: held by the capture thread feeding the context */
+	pthread_mutex_t			rx_lock;
+
+	/* loss telemetry, published to common->capture */
+	capture_stats_t			stats;
+	latency_stats_t			latency;	/* worker side, to common->latency */
+	uint64_t			rx_us;		/* arrival of the packet being parsed */
+	uint32_t			frame_fd_missing;	/* current frame */
+	uint16_t			fd_size;		/* stream fragment: last non-tail FD payload */
+
+	/*
+	 * Camera streams (-N): packets are reassembled per source address
+	 * and flow id, each stream in its own context.  The configured
+	 * context is stream 0 and owns the table, the others are made on
+	 * their first packet from the copy taken before the capture began.
+	 */
+	struct cam4_rd_s		**streams;
+	unsigned			nstreams;
+	unsigned			max_streams;	/* <2 - everything is stream 0 */
+	struct cam4_rd_s		*stream_tmpl;
+	unsigned			stream_idx;
+	uint32_t			stream_src;	/* network order */
+	uint32_t			stream_lid;	/* lid[30:0] */
 } cam4_rd_t;
 
+/* hdr->work is the frame: partial and missing[] give what never arrived */
 typedef int (*cam4_ps_cb_f)(cam4_rd_t *hdr);
 
 extern int cam4_ps_start(int argc, char **argv);
@@ -114,6 +114,7 @@ common_t *common;
 int fd = -1;
 int debug = 0;
 int get_params = 0;
+unsigned stream = 0;	/* camera stream of cam4_ps -N */
 
 uint8_t* shmaddr[2] = { };
 uint8_t* shmaddr3;
@@ -442,8 +443,6 @@ int add_hist_from_oob(XvImage *yuv_image,int num_bins,uint32_t* hist) {
 
 int add_subwindow(XvImage* yuv_image, int startx, int starty, int totalx, int totaly) {
 	int x,y;
-	startx -= startx%16;
-	starty -= starty%16;
 	for (x=-300; x<-100;x++) {
 		yuv_image->data[(yuv_image->height-300)*yuv_image->width*2+x*2+1] = (uint8_t) 255;
 		yuv_image->data[(yuv_image->height-100)*yuv_image->width*2+x*2+1] = (uint8_t) 255;
@@ -609,6 +608,48 @@ void draw_params(
 #endif
 }
 
+/* the window: the whole frame as far as the Xv port takes it */
+static void xv_fit(common_t *common)
+{
+	if (common->xvWidth < common->sensWidth)
+		common->width = common->xvWidth;
+	else
+		common->width = common->sensWidth;
+	if (common->xvHeight < common->sensHeight)
+		common->height = common->xvHeight;
+	else
+		common->height = common->sensHeight;
+}
+
+/* Xv image over yuv segment n of the camera stream */
+static XvImage *xv_shm_attach(Display *dpy, common_t *common, unsigned n, XShmSegmentInfo *shminfo)
+{
+	XvImage	*yuv_image;
+	key_t	key = key_stream(n ? key_yuv2 : key_yuv1, stream);
+
+	yuv_image = XvShmCreateImage(dpy, xv_port, 0x59565955, 0, common->width, common->height, shminfo);
+	shminfo->shmid = shmget(key, 0, 0);
+	if(shminfo->shmid < 0)
+		shminfo->shmid = shmget(key, common->sensWidth * common->sensHeight * 2 + 4096, IPC_EXCL | IPC_CREAT | 0666);
+	shminfo->shmaddr = yuv_image->data = shmat(shminfo->shmid, 0, 0);
+	shminfo->readOnly = False;
+	shmaddr[n] = (uint8_t*)shminfo->shmaddr;
+	if (!XShmAttach(dpy, shminfo)) {
+		TRACE(3,"XShmAttach failed !\n");
+		exit (-1);
+	}
+
+	TRACE(0, "shmem id%u = %d \n", n + 1, shminfo->shmid);
+	return yuv_image;
+}
+
+static void xv_shm_detach(Display *dpy, XvImage *yuv_image, XShmSegmentInfo *shminfo)
+{
+	XShmDetach(dpy, shminfo);
+	XFree(yuv_image);
+	shmdt(shminfo->shmaddr);
+}
+
 int read_xv_buf(common_t* common)
 {
 	XvImage *yuv_image_ar[2];
@@ -647,6 +688,7 @@ int read_xv_buf(common_t* common)
 	/* for shm */
 	int 			shmem_flag = 0;
 	XShmSegmentInfo	yuv_shminfo1 = {}, yuv_shminfo2 ={};
+	uint32_t		geometry_seq;
 //	int			CompletionType;
 
 	TRACE(3,"starting up video testapp...\n\n");
@@ -741,14 +783,7 @@ int read_xv_buf(common_t* common)
 		common->xvHeight = ei[0].height;
 		//common->xvWidth = 800;
 		//common->xvHeight = 600;
-		if (common->xvWidth < common->sensWidth)
-			common->width = common->xvWidth;
-		else
-			common->width = common->sensWidth;
-		if (common->xvHeight < common->sensHeight)
-			common->height = common->xvHeight;
-		else
-			common->height = common->sensHeight;
+		xv_fit(common);
 		XvFreeEncodingInfo(ei);
 
 		at = XvQueryPortAttributes(dpy, p, &attributes);
@@ -895,36 +930,10 @@ int read_xv_buf(common_t* common)
 //    char * def = 0;
 //	fontset = XCreateFontSet(dpy,"-*-fixed-*-*-*-*-13-*-*-*-*-*-*-*", &missing, &nmissing, &def);
 
-    yuv_image_ar[0] = XvShmCreateImage(dpy, xv_port, 0x59565955, 0, common->width, common->height, &yuv_shminfo1);
-    yuv_image = yuv_image_ar[0];
-    yuv_shminfo1.shmid = shmget(key_yuv1, 0, 0);
-    if(yuv_shminfo1.shmid<0)
-	    yuv_shminfo1.shmid = shmget(key_yuv1, common->sensWidth * common->sensHeight * 2+4096, IPC_EXCL |IPC_CREAT | 0666);
-    yuv_shminfo1.shmaddr = yuv_image->data = shmat(yuv_shminfo1.shmid, 0, 0);
-    yuv_shminfo1.readOnly = False;
-	shmaddr[0] = (uint8_t*)yuv_shminfo1.shmaddr;
-    if (!XShmAttach(dpy, &yuv_shminfo1)) {
-		TRACE(3,"XShmAttach failed !\n");
-		exit (-1);
-    }
-
-    TRACE(0, "shmem id1 = %d \n", yuv_shminfo1.shmid );
-
-    yuv_image_ar[1] = XvShmCreateImage(dpy, xv_port, 0x59565955, 0, common->width, common->height, &yuv_shminfo2);
+    geometry_seq = common->geometry_seq;
+    yuv_image_ar[0] = xv_shm_attach(dpy, common, 0, &yuv_shminfo1);
+    yuv_image_ar[1] = xv_shm_attach(dpy, common, 1, &yuv_shminfo2);
     yuv_image = yuv_image_ar[1];
-    yuv_shminfo2.shmid = shmget(key_yuv2, 0, 0);
-    if(yuv_shminfo2.shmid < 0)
-	    yuv_shminfo2.shmid = shmget(key_yuv2, common->sensWidth * common->sensHeight * 2 +4096, IPC_CREAT |IPC_EXCL| 0666);
-    yuv_shminfo2.shmaddr = yuv_image->data = shmat(yuv_shminfo2.shmid, 0, 0);
-    yuv_shminfo2.readOnly = False;
-    shmaddr[1] = (uint8_t*)yuv_shminfo2.shmaddr;
-    if (!XShmAttach(dpy, &yuv_shminfo2)) {
-		TRACE(0,"XShmAttach failed !\n");
-		exit (-1);
-    }
-    //TRACEPNF(0,"yuv image 1 ptr =============  %d\n",(uint32_t)yuv_image_ar[0]->data);
-    //TRACEPNF(0,"yuv image 2 ptr =============  %d\n",(uint32_t)yuv_image_ar[1]->data);
-	TRACE(0, "shmem id2 = %d \n", yuv_shminfo2.shmid );
 	TRACE(0, "Shared size %d\n", yuv_image->data_size);
 
 	yuv_image = yuv_image_ar[0];
@@ -1054,6 +1063,22 @@ int read_xv_buf(common_t* common)
 		}
 		if (get_params)
 			send_command("GET:");
+
+		/* cam4_ps switched the sensor mode or ROI: the segments are new */
+		if (common->geometry_seq != geometry_seq) {
+			geometry_seq = common->geometry_seq;
+			TRACEPNF(0, "Geometry: %d x %d\n", common->sensWidth, common->sensHeight);
+
+			xv_shm_detach(dpy, yuv_image_ar[0], &yuv_shminfo1);
+			xv_shm_detach(dpy, yuv_image_ar[1], &yuv_shminfo2);
+			xv_fit(common);
+			yuv_image_ar[0] = xv_shm_attach(dpy, common, 0, &yuv_shminfo1);
+			yuv_image_ar[1] = xv_shm_attach(dpy, common, 1, &yuv_shminfo2);
+			osd_yuyv_init(&(osd[0]), yuv_image_ar[0]->data, font, CM0, common->width, common->height);
+			osd_yuyv_init(&(osd[1]), yuv_image_ar[1]->data, font, CM0, common->width, common->height);
+			XResizeWindow(dpy, window, common->width, common->height);
+		}
+
 		int j = common->frame_idx_done;
 		yuv_image = yuv_image_ar[j];
 
@@ -1140,7 +1165,7 @@ int main(int argc, char** argv) {
 	I = stdout;
 	fd = open("/tmp/cam4.fifo", O_WRONLY | O_NONBLOCK,0x666);
 	signal(SIGINT, sigproc);
-	while ((i = getopt(argc, argv, "p:t:h:g")) != -1) {
+	while ((i = getopt(argc, argv, "p:t:h:gn:")) != -1) {
 		switch(i){
 			case 'h':
 				show_help();
@@ -1155,9 +1180,13 @@ int main(int argc, char** argv) {
 			case 'g':
 				get_params = 1;
 				break;
+			case 'n':
+	    	/* camera stream */
+				stream = strtoul(optarg, (char **)NULL, 0);
+				break;
 		}
 	}
-	int shmid = shmget(key_common,sizeof(common_t),IPC_CREAT | 0666);
+	int shmid = shmget(key_stream(key_common, stream),sizeof(common_t),IPC_CREAT | 0666);
 	printf("%d\n", shmid);
 	common = shmat(shmid,NULL,0);
 	shmaddr3 = (uint8_t*)common;
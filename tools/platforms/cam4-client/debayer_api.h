@@ -32,8 +32,16 @@ typedef void _debayerRGB_func(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,
 
 typedef struct {
 	_debayerRGB_func *debayerRGB_func[4];
+	const char	*name;		/* kernel set, for diagnostics */
 } debayer_api_t;
 
 extern int arch_probe_fast_debayer(debayer_api_t *api, int dim_x, int startx, int ww);
 
+/* debayer_scalar.c: portable kernels of modes 0 - 3, debayerRGB_ar_mode1 is an alternative of mode 1 */
+extern _debayerRGB_func debayerRGB_fast_mode0;
+extern _debayerRGB_func debayerRGB_fast_mode1;
+extern _debayerRGB_func debayerRGB_fast_mode2;
+extern _debayerRGB_func debayerRGB_fast_mode3;
+extern _debayerRGB_func debayerRGB_ar_mode1;
+
 #endif
@@ -0,0 +1,383 @@
+/*\
+ *
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+#include <stdint.h>
+#include <string.h>
+#include <compiler.h>
+
+#define TRACE_PRIVATE_PREFIX	1
+#include <trace.h>
+
+#include "debayer_api.h"
+
+static char* trace_prefix = "debayer_avx: ";
+
+/* Q15 coefficients of debayerRGB_fast_mode*() */
+#define COEF_RY		9797		/* 0.299 */
+#define COEF_GY		19234		/* 0.587 */
+#define COEF_BY		3735		/* 0.114 */
+#define COEF_CR		23363		/* 0.713 */
+#define COEF_CB		18481		/* 0.564 */
+
+#define Q15(a, k)	((int16_t)(((int32_t)(a) * (k)) >> 15))
+
+/*
+ * debayerRGB_fast_mode*() a pixel at a time.  A row of the window is a red
+ * or a blue row, its R or B samples (the site) on the odd or the even
+ * columns; the next row swaps both.  The pixel at window column x of row y
+ * (1 .. ww - 2, 1 .. wh - 2) goes to YUYV pixel x of row y - 1: Y and Cr on
+ * odd columns, Y and Cb on even.  Pixels 0 and ww - 1 repeat Y and Cr of
+ * columns 1 and ww - 2.
+ */
+static uint16_t db_pixel(const uint8_t *p, int dim_x, int red, int site, int cr)
+{
+	int	n = p[-dim_x], s = p[dim_x], w = p[-1], e = p[1];
+	int	own, g, oth, r, b, y;
+
+	if(site) {
+		own	= p[0];
+		g	= (n + s + w + e) >> 2;
+		oth	= (p[-dim_x - 1] + p[-dim_x + 1] + p[dim_x - 1] + p[dim_x + 1]) >> 2;
+	} else {
+		own	= (w + e) >> 1;
+		g	= p[0];
+		oth	= (n + s) >> 1;
+	}
+	r	= red ? own : oth;
+	b	= red ? oth : own;
+
+	y	= (uint16_t)(Q15(r, COEF_RY) + Q15(g, COEF_GY) + Q15(b, COEF_BY));
+	if(cr)
+		return (uint8_t)(Q15(r - y, COEF_CR) + 128) | y << 8;
+
+	return (uint8_t)(Q15(b - y, COEF_CB) + 128) | y << 8;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define cpuid(func,sub,ax,bx,cx,dx)\
+	__asm__ __volatile__ ("cpuid":\
+	"=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func), "c" (sub));
+
+/*
+ * 16 bit lanes, a register of them at a time: 16 odd and 16 even columns
+ * for AVX2, 32 and 32 for AVX-512.  A row seen as 16 bit
+ * lanes is its even and odd columns: the pixels of a vector have the same
+ * colour, the neighbours come from two loads a row.  (a * k) >> 15 goes by
+ * the bytes of k, no product of a sample or a difference of two leaves
+ * 16 bits.  The bytes reach the multiply from a register: of a constant
+ * GCC makes shifts and adds, twice the instructions.
+ */
+typedef uint16_t	v16hu __attribute__((vector_size(32)));
+typedef int16_t		v16hi __attribute__((vector_size(32)));
+typedef uint16_t	v32hu __attribute__((vector_size(64)));
+typedef int16_t		v32hi __attribute__((vector_size(64)));
+
+#define DB_K(a, k)	({ __typeof__(a) _k = (__typeof__(a)){} + (k); __asm__("" : "+v" (_k)); _k; })
+#define Q15V(a, k)	(((a) * DB_K(a, (k) >> 8) + ((a) * DB_K(a, (k) & 0xff) >> 8)) >> 7)
+
+/* 32 bytes of the odd and the even pixels lane by lane */
+#define DB_ZIP_LO	0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23
+#define DB_ZIP_HI	8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31
+
+/* columns 0, 2 .. from s in lo, 1, 3 .. in hi */
+#define DB_SPLIT(lo, hi, s)						\
+	do {								\
+		memcpy(&lo, s, sizeof(lo));				\
+		hi	= lo >> 8;					\
+		lo	&= 0xff;					\
+	} while(0)
+
+/* own colour (R or B), green and the other of a site or a green pixel */
+#define DB_SITE(C, N, S, W, E, NW, NE, SW, SE)				\
+	do {								\
+		own	= C;						\
+		g	= (N + S + W + E) >> 2;				\
+		oth	= (NW + NE + SW + SE) >> 2;			\
+	} while(0)
+
+#define DB_GREEN(C, N, S, W, E)						\
+	do {								\
+		own	= (W + E) >> 1;					\
+		g	= C;						\
+		oth	= (N + S) >> 1;					\
+	} while(0)
+
+/* YUYV lanes of own, g and oth, chroma | Y << 8: Cr or Cb */
+#define DB_YUV(v, HI, CHROMA, COEF)					\
+	do {								\
+		r	= red ? own : oth;				\
+		b	= red ? oth : own;				\
+		y	= Q15V(r, COEF_RY) + Q15V(g, COEF_GY) + Q15V(b, COEF_BY);	\
+		k	= Q15V((HI)(CHROMA - y), COEF);			\
+		v	= (((__typeof__(y))k + 128) & 0xff) | y << 8;	\
+	} while(0)
+
+/*
+ * db_row_ISA(): a row of the window from column 0 at p to ww YUYV pixels
+ * at out.  A block is db_pixel() of the 2 * lanes columns from p on, the
+ * first one odd; columns -1, 0, 1, 2 (+ 2i) of a row are x0, x1, x2, x3.
+ * The last block overlaps the one before rather than leaving columns to
+ * db_pixel().
+ */
+#define DB_ROW(ISA, TARGET, HU, HI)							\
+__attribute__((target(TARGET)))								\
+static __inline__ void db_block_##ISA(uint8_t *out, const uint8_t *p, int dim_x, int red, int site_odd) \
+{											\
+	HU	n0, n1, n2, n3, c0, c1, c2, c3, s0, s1, s2, s3;				\
+	HU	own, g, oth, r, b, y, odd, even;					\
+	HI	k;									\
+	v16hu	h[2 * sizeof(HU) / sizeof(v16hu)], v;					\
+	unsigned i, n = sizeof(HU) / sizeof(v16hu);					\
+											\
+	DB_SPLIT(n0, n1, p - dim_x - 1);						\
+	DB_SPLIT(n2, n3, p - dim_x + 1);						\
+	DB_SPLIT(c0, c1, p - 1);							\
+	DB_SPLIT(c2, c3, p + 1);							\
+	DB_SPLIT(s0, s1, p + dim_x - 1);						\
+	DB_SPLIT(s2, s3, p + dim_x + 1);						\
+											\
+	if(site_odd)									\
+		DB_SITE(c1, n1, s1, c0, c2, n0, n2, s0, s2);				\
+	else										\
+		DB_GREEN(c1, n1, s1, c0, c2);						\
+	DB_YUV(odd, HI, r, COEF_CR);							\
+											\
+	if(site_odd)									\
+		DB_GREEN(c2, n2, s2, c1, c3);						\
+	else										\
+		DB_SITE(c2, n2, s2, c1, c3, n1, n3, s1, s3);				\
+	DB_YUV(even, HI, b, COEF_CB);							\
+											\
+	memcpy(&h[0], &odd, sizeof(odd));						\
+	memcpy(&h[n], &even, sizeof(even));						\
+	for(i = 0; i < n; i++) {							\
+		v = __builtin_shufflevector(h[i], h[n + i], DB_ZIP_LO);			\
+		memcpy(out + 2 * i * sizeof(v), &v, sizeof(v));				\
+		v = __builtin_shufflevector(h[i], h[n + i], DB_ZIP_HI);			\
+		memcpy(out + (2 * i + 1) * sizeof(v), &v, sizeof(v));			\
+	}										\
+}											\
+											\
+__attribute__((target(TARGET)))								\
+static void db_row_##ISA(uint8_t *out, const uint8_t *p, int dim_x, int ww, int red, int site_odd) \
+{											\
+	const int	block = 2 * sizeof(HU) / sizeof(uint16_t);			\
+	uint16_t	v;								\
+	int		x;								\
+											\
+	for(x = 1; x + block <= ww - 1; x += block)					\
+		db_block_##ISA(out + 2 * x, p + x, dim_x, red, site_odd);		\
+											\
+	if(x < ww - 1 && ww - 1 > block)						\
+		db_block_##ISA(out + 2 * (ww - 1 - block), p + ww - 1 - block, dim_x, red, site_odd); \
+	else										\
+		for(; x < ww - 1; x++) {						\
+			v = db_pixel(p + x, dim_x, red, (x & 1) == site_odd, x & 1);	\
+			out[2 * x]	= v;						\
+			out[2 * x + 1]	= v >> 8;					\
+		}									\
+											\
+	v = db_pixel(p + 1, dim_x, red, site_odd, 1);					\
+	out[0]		= v;								\
+	out[1]		= v >> 8;							\
+	v = db_pixel(p + ww - 2, dim_x, red, !site_odd, 1);				\
+	out[2 * ww - 2]	= v;								\
+	out[2 * ww - 1]	= v >> 8;							\
+}
+
+DB_ROW(avx2, "avx2", v16hu, v16hi)
+DB_ROW(avx512, "avx512bw", v32hu, v32hi)
+
+typedef void db_row_t(uint8_t *out, const uint8_t *p, int dim_x, int ww, int red, int site_odd);
+
+/* mode - the Bayer phase of debayerRGB_fast_mode*() */
+static void db_frame(uint8_t *dst, const uint8_t *src, int dim_x, int dim_y,
+	int startx, int starty, int ww, int wh, int mode, db_row_t *row)
+{
+	int	red = mode < 2, site_odd = mode == 1 || mode == 2, y;
+
+	if(ww && wh) {
+		src += dim_x * starty + startx;
+	} else {
+		ww = dim_x;
+		wh = dim_y;
+	}
+
+	for(y = 1; y < wh - 1; y++, dst += 2 * ww) {
+		row(dst, src + y * dim_x, dim_x, ww, red, site_odd);
+		red		= !red;
+		site_odd	= !site_odd;
+	}
+}
+
+#define DB_KERNEL(MODE, ISA)									\
+static void debayerRGB_mode##MODE##_##ISA(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,	\
+	int startx, int starty, int ww, int wh)							\
+{												\
+	db_frame(dst, src, dim_x, dim_y, startx, starty, ww, wh, MODE, db_row_##ISA);		\
+}
+
+DB_KERNEL(0, avx2)
+DB_KERNEL(1, avx2)
+DB_KERNEL(2, avx2)
+DB_KERNEL(3, avx2)
+DB_KERNEL(0, avx512)
+DB_KERNEL(1, avx512)
+DB_KERNEL(2, avx512)
+DB_KERNEL(3, avx512)
+
+static const debayer_api_t	db_avx2 = { {
+	debayerRGB_mode0_avx2, debayerRGB_mode1_avx2, debayerRGB_mode2_avx2, debayerRGB_mode3_avx2 }, "AVX2" };
+static const debayer_api_t	db_avx512 = { {
+	debayerRGB_mode0_avx512, debayerRGB_mode1_avx512, debayerRGB_mode2_avx512, debayerRGB_mode3_avx512 }, "AVX-512" };
+
+/* widest kernels the CPU and the OS (XCR0 keeps the state) run, NULL - none */
+static const debayer_api_t *db_probe(void)
+{
+	unsigned	a, b, c, d, max, lo, hi;
+
+	cpuid(0, 0, max, b, c, d);
+	if(max < 7)
+		return NULL;
+
+	/* OSXSAVE, AVX */
+	cpuid(1, 0, a, b, c, d);
+	if((c & 0x18000000) != 0x18000000)
+		return NULL;
+	__asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+
+	cpuid(7, 0, a, b, c, d);
+	/* AVX-512F and BW, opmask and zmm state */
+	if((b & 0x40010000) == 0x40010000 && (lo & 0xe6) == 0xe6)
+		return &db_avx512;
+	if((b & 0x20) && (lo & 6) == 6)			/* AVX2 */
+		return &db_avx2;
+
+	return NULL;
+}
+#else
+static const debayer_api_t *db_probe(void)
+{
+	return NULL;
+}
+#endif
+
+int arch_probe_fast_debayer(debayer_api_t *api, int dim_x, int startx, int ww)
+{
+	static int early_probe = -1;
+	static debayer_api_t _api = {};
+	const debayer_api_t *fast;
+
+	/* any start and width: the kernels load unaligned, the ends of a row overlap */
+	if(ww & 1)
+		return -1;
+
+	if(early_probe == -1) {
+		fast = db_probe();
+		if(fast) {
+			_api = *fast;
+			TRACEP(0, "%s: %s selected\n", __func__, fast->name);
+			early_probe = 1;
+		} else {
+			TRACEP(0, "%s: no optimization engine found\n", __func__);
+			early_probe = 0;
+		}
+	}
+
+	if(early_probe > 0)
+		*api = _api;
+
+	return early_probe;
+}
+
+#ifdef ELEMENTARY_TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+FILE *I;
+
+/* every kernel this CPU runs against debayer_scalar.c, frames and windows */
+int main(int argc, char **argv)
+{
+	static const int	geom[][6] = {	/* dim_x dim_y startx starty ww wh */
+		{ 16, 8, 0, 0, 16, 8 }, { 32, 6, 0, 0, 32, 6 }, { 48, 12, 16, 2, 32, 8 },
+		{ 64, 20, 0, 0, 0, 0 }, { 1936, 40, 0, 0, 1936, 40 }, { 1936, 48, 16, 4, 1904, 40 },
+		{ 2048, 16, 128, 2, 1024, 14 }, { 1928, 40, 0, 0, 1928, 40 }, { 1928, 44, 6, 2, 1920, 40 },
+		{ 1928, 44, 7, 3, 1000, 38 }, { 100, 9, 1, 1, 66, 6 }, { 70, 8, 3, 1, 34, 6 }, { 30, 6, 5, 1, 20, 4 } };
+	static _debayerRGB_func	*ref[4] = { debayerRGB_fast_mode0, debayerRGB_fast_mode1,
+		debayerRGB_fast_mode2, debayerRGB_fast_mode3 };
+	const debayer_api_t	*api[2];
+	const debayer_api_t	*cpu;
+	unsigned		napi = 0, err = 0, g, m, k, n;
+	size_t			z, size, out;
+	uint8_t			*src, *d_ref, *d_v;
+
+	I = stdout;
+	if(!(cpu = db_probe())) {
+		printf("debayer_avx: no AVX2, nothing to check\n");
+		return 0;
+	}
+	api[napi++] = &db_avx2;
+	if(cpu == &db_avx512)
+		api[napi++] = &db_avx512;
+
+	srand(1);
+	for(g = 0; g < sizeof(geom) / sizeof(geom[0]); g++) {
+		const int	*q = geom[g];
+		int		ww = q[4] ? q[4] : q[0], wh = q[5] ? q[5] : q[1];
+
+		size	= (size_t)q[0] * q[1];
+		out	= (size_t)2 * ww * (wh - 2);
+		src	= malloc(size);
+		d_ref	= malloc(out + 64);
+		d_v	= malloc(out + 64);
+		for(z = 0; z < size; z++)
+			src[z] = rand();
+
+		for(m = 0; m < 4; m++) {
+			ref[m](d_ref, src, q[0], q[1], q[2], q[3], q[4], q[5]);
+			for(k = 0; k < napi; k++) {
+				memset(d_v, 0xa5, out + 64);
+				api[k]->debayerRGB_func[m](d_v, src, q[0], q[1], q[2], q[3], q[4], q[5]);
+				for(n = 0; n < 64; n++)
+					err += d_v[out + n] != 0xa5;
+				if(memcmp(d_ref, d_v, out)) {
+					printf("%s: mode %u %dx%d window %d,%d %dx%d: MISMATCH\n",
+					    api[k]->name, m, q[0], q[1], q[2], q[3], ww, wh);
+					err++;
+				}
+			}
+		}
+		free(src);
+		free(d_ref);
+		free(d_v);
+	}
+
+	printf("debayer_avx: %s kernels checked, %u mismatches\n", napi > 1 ? "avx512 and avx2" : "avx2", err);
+	return !!err;
+}
+#endif
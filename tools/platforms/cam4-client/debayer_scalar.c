@@ -0,0 +1,770 @@
+/*\
+ *  
+ *  Copyright (C) 2004-2014 VOCORD, Inc. <info@vocord.com>
+ *
+ * This file is part of the P3SS API/ABI/VERIFICATION system.
+ *
+ * The P3SS API/ABI/VERIFICATION system is free software; you can
+ * redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The part of the P3SS API/ABI/VERIFICATION system
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the part of the P3SS API/ABI/VERIFICATION system;
+ * if not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *       Component for conform portion of the system.
+\*/
+
+/* portable debayer kernels: the default ones and the reference of the SIMD ones */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "debayer_api.h"
+
+static const int16_t coefrY=9797; // 0.299
+static const int16_t coefgY= 19234; // 0.587
+static const int16_t coefbY= 3735; // 0.114
+
+static const int16_t coefCr= 23363;// 0.713
+static const int16_t coefCb= 18481;// 0.564
+
+
+static inline int16_t mul16x16s(int16_t a,int16_t b)
+{
+	return (int16_t)(((int32_t)a*b) >> 15);
+}
+
+void debayerRGB_fast_mode0(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
+{
+	int x,y;
+	int r,g,b;
+	int window_width,window_height;
+	int remain_size;
+	if(ww && wh)   // working with window in image
+	{
+	    window_width= ww-2;
+	    window_height= wh-2;
+	    remain_size= dim_x-ww;
+	    src+=(dim_x*starty+startx);
+	}
+	else
+	{
+	    window_width= dim_x-2;
+	    window_height= dim_y-2;
+	    remain_size=0;
+	}
+	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
+	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
+	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
+	uint16_t Y,Cr,Cb;
+	uint8_t *out=dst;
+
+			//for( y=1; y < dim_y - 1; y+=2 )
+			y= window_height;
+			do
+			{
+				/* green 1 */
+				r = (*left + *right)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+		    		g =  *center;			//d_RGB_y[x];
+		    		b = (*low + *high)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+
+				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+				//Cr= (uint8_t)(0.713*(r-Y) + 128);
+				Cr= (mul16x16s(r-Y,coefCr)+128);
+									/* copy data on edge */
+				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				*out++=Y;			//dst[j+1] = Y;		// Luma
+								//j += 2;
+				//for( x=1; x < dim_x - 1; x+=2 )
+				x= window_width;
+				do
+				{
+						/* green 1 */
+					r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+		    			g =  *center++;			//d_RGB_y[x];
+		    			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+					low_left++;low_right++;high_left++;high_right++;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cr= (uint8_t)(0.713*(r-Y) + 128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cr;
+					*out++=Y;
+		    				/* red */
+		    			r= *center++;							  //r =  d_RGB_y[x];
+		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cb= (uint8_t)(0.564*(b-Y) + 128);
+					Cb= (mul16x16s(b-Y,coefCb)+128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cb;
+					*out++=Y;
+
+				}
+				while(x-=2);
+				/* copy data on edge */
+				*out++=Cr;	//dst[j+1] = Y;		// Luma
+				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+						//j += 2;
+
+
+				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+				low+=(2+remain_size);high+=(2+remain_size);
+				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+				/* blue */
+		    		r= (*low_left + *low_right + *high_left + *high_right)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+		    		g= (*low + *left + *right + *high)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    		b =  *center;							//d_RGB_y[x];
+
+				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+				//Cr= (uint8_t)(0.713*(r-Y) + 128);
+				Cr= (mul16x16s(r-Y,coefCr)+128);
+
+				/* copy data on edge */
+
+				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				*out++=Y;			//dst[j+1] = Y;		// Luma
+									//j += 2;
+				//for( x=1; x < dim_x - 1; x+=2 )
+				x= window_width;
+				do
+				{
+					/* blue */
+		    			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    			b =  *center++;							//d_RGB_y[x];
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cr= (uint8_t)(0.713*(r-Y) + 128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+
+					*out++=Cr;
+					*out++=Y;
+
+		  		    /* green 2 */
+		    			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+		    			g =  *center++;		//g=d_RGB_y[x];
+		    			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+					low_left++;low_right++;high_left++;high_right++;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cb= (uint8_t)(0.564*(b-Y) + 128);
+					Cb= (mul16x16s(b-Y,coefCb)+128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cb;
+					*out++=Y;
+				}
+				while(x-=2);
+				/* copy data on edge */
+				*out++=Cr;	//dst[j+1] = Y;		// Luma
+				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+						//j += 2;
+
+				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+				low+=(2+remain_size);high+=(2+remain_size);
+				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+
+			}
+			while(y-=2);
+}
+
+#if 1
+typedef struct {
+	uint8_t		left;
+	uint8_t		center;
+	uint8_t		right;
+} __attribute__((packed)) bayer_trio_t;
+
+// SENS_BAYER_RGB_PHASE_RG1BG2	= (0x1<<0)
+void debayerRGB_ar_mode1(uint8_t *_dst, uint8_t *_src, int dim_x, int dim_y, int startx, int starty, int ww, int wh)
+{
+	int 		x, y = 0;
+	int 		r, g, b;
+	int 		window_width, window_height;
+	uint16_t 	Y, Cr, Cb;
+	uint8_t 	*out = _dst;
+	uint8_t		*cur_line = _src;
+
+	bayer_trio_t	*high, *mid, *low;
+
+	printf("XXX\n");
+
+	if(ww && wh) {  // working with window in image
+	    window_width  = ww - 2;
+	    window_height = wh - 2;
+	    cur_line += (dim_x * starty + startx);
+	} else {
+	    window_width  = dim_x - 2;
+	    window_height = dim_y - 2;
+	}
+
+	/**** main body ****/
+	do {
+		x = 0;
+
+		high = (bayer_trio_t*)cur_line;
+		mid  = high + dim_x;
+		low  = mid + dim_x;
+
+		do {
+			r = mid->center;
+			g = (high->center + mid->left   + mid->right + low->center) >> 2;
+			b = (high->left   + high->right + low->left  + low->right ) >> 2;
+
+			Y  = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
+			Cr = (mul16x16s(r-Y,coefCr) + 128);
+			//Cb = (mul16x16s(b-Y,coefCb) + 128);
+
+			*out++ = Cr;
+			*out++ = Y;
+
+			if(!x) {
+				/* copy data to edge */
+				*out++ = Cr;
+				*out++ = Y;
+			}
+			
+			high = (typeof(high))((uint8_t*)high + 1);
+			mid  = (typeof(mid))((uint8_t*)mid + 1);
+			low  = (typeof(low))((uint8_t*)low + 1);
+
+			r = (mid->left + mid->right) >> 1;
+			g = mid->center;
+			b = (high->center + low->center) >> 1;
+
+			Y = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
+			Cb= (mul16x16s(b-Y,coefCb)+128);
+			//Cr= (mul16x16s(r-Y,coefCr)+128);
+
+			*out++ = Cb;
+			*out++ = Y;
+
+			high = (typeof(high))((uint8_t*)high + 1);
+			mid  = (typeof(mid))((uint8_t*)mid + 1);
+			low  = (typeof(low))((uint8_t*)low + 1);
+
+			x += 2;
+		} while(x < window_width);
+
+		/* copy data to edge */
+		*out++ = Cb;
+		*out++ = Y;
+
+		/* advance to next line */
+
+		cur_line += dim_x;
+
+		high = (bayer_trio_t*)cur_line;
+		mid  = high + dim_x;
+		low  = mid + dim_x;
+
+		x = 0;
+
+		do {
+			r = (high->center + low->center) >> 1;
+			g = mid->center;
+			b = (mid->left + mid->right) >> 1;
+
+			Y  = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
+			Cr = (mul16x16s(r-Y,coefCr) + 128);
+			//Cb = (mul16x16s(b-Y,coefCb) + 128);
+
+			*out++ = Cr;
+			*out++ = Y;
+
+			if(!x) {
+				/* copy data to edge */
+				*out++ = Cr;
+				*out++ = Y;
+			}
+			
+			high = (typeof(high))((uint8_t*)high + 1);
+			mid  = (typeof(mid))((uint8_t*)mid + 1);
+			low  = (typeof(low))((uint8_t*)low + 1);
+
+			r = (high->left + high->right + low->left + low->right) >> 2;
+			g = (mid->left + high->center + mid->right + low->center) >> 2;
+			b = mid->center;
+
+			Y = (mul16x16s(r,coefrY) + mul16x16s(g,coefgY) + mul16x16s(b,coefbY));
+			Cb= (mul16x16s(b-Y,coefCb)+128);
+			//Cr= (mul16x16s(r-Y,coefCr)+128);
+
+			*out++ = Cb;
+			*out++ = Y;
+
+			high = (typeof(high))((uint8_t*)high + 1);
+			mid  = (typeof(mid))((uint8_t*)mid + 1);
+			low  = (typeof(low))((uint8_t*)low + 1);
+
+			x += 2;
+		} while(x < window_width);
+
+		/* copy data to edge */
+		*out++ = Cr;
+		*out++ = Y;
+
+		/* advance to next line */
+		cur_line += dim_x;
+		
+		y += 2;
+	} while(y < window_height);
+
+}
+#endif
+
+void debayerRGB_fast_mode1(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
+{
+	int x,y;
+	int r,g,b;
+	int window_width,window_height;
+	int remain_size;
+	if(ww && wh)   // working with window in image
+	{
+	    window_width= ww-2;
+	    window_height= wh-2;
+	    remain_size= dim_x-ww;
+	    src+=(dim_x*starty+startx);
+	}
+	else
+	{
+	    window_width= dim_x-2;
+	    window_height= dim_y-2;
+	    remain_size=0;
+	}
+	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
+	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
+	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
+	uint16_t Y,Cr,Cb;
+	uint8_t *out=dst;
+
+	//for( y=1; y < dim_y - 1; y+=2 )
+	y= window_height;
+	do
+	{
+			    /* red */
+		r= *center;							  //r =  d_RGB_y[x];
+		g= (*low + *left + *right + *high)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		b= (*low_left + *low_right + *high_left + *high_right)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+
+		//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+		Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+		//Cr= (uint8_t)(0.713*(r-Y) + 128);
+		Cr= (mul16x16s(r-Y,coefCr)+128);
+
+		*out++=Cr;
+		*out++=Y;
+		//for( x=1; x < dim_x - 1; x+=2 )
+		x= window_width;
+		do
+		{
+
+				/* red */
+			r= *center++;							  //r =  d_RGB_y[x];
+			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+
+			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+			//Cr= (uint8_t)(0.713*(r-Y) + 128);
+			Cr= (mul16x16s(r-Y,coefCr)+128);
+
+			*out++=Cr;
+			*out++=Y;
+
+				/* green 1 */
+			r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+			g =  *center++;			//d_RGB_y[x];
+			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+			low_left++;low_right++;high_left++;high_right++;
+			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+			//Cb= (uint8_t)(0.564*(b-Y) + 128);
+			Cb= (mul16x16s(b-Y,coefCb)+128);
+			Cr= (mul16x16s(r-Y,coefCr)+128);
+
+			*out++=Cb;
+			*out++=Y;
+
+		}
+		while(x-=2);
+		/* copy data on edge */
+		*out++=Cr;	//dst[j+1] = Y;		// Luma
+		*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				//j += 2;
+
+		left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+		low+=(2+remain_size);high+=(2+remain_size);
+		low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+
+		 /* green 2 */
+		r= (*low + *high)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+		g =  *center;		//g=d_RGB_y[x];
+		b= (*left + *right) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+
+		//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+		Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+		//Cr= (uint8_t)(0.713*(r-Y) + 128);
+		Cr= (mul16x16s(r-Y,coefCr)+128);
+
+		/* copy data on edge */
+
+		*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+		*out++=Y;			//dst[j+1] = Y;		// Luma
+							//j += 2;
+		//for( x=1; x < dim_x - 1; x+=2 )
+		x= window_width;
+		do
+		{
+
+			/* green 2 */
+			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+			g =  *center++;		//g=d_RGB_y[x];
+			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+			low_left++;low_right++;high_left++;high_right++;
+
+			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+			//Cr= (uint8_t)(0.713*(r-Y) + 128);
+			Cr= (mul16x16s(r-Y,coefCr)+128);
+
+			*out++=Cr;
+			*out++=Y;
+			/* blue */
+			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+			b =  *center++;							//d_RGB_y[x];
+
+			//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+			Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+			//Cb= (uint8_t)(0.564*(b-Y) + 128);
+			Cb= (mul16x16s(b-Y,coefCb)+128);
+			Cr= (mul16x16s(r-Y,coefCr)+128);
+
+			*out++=Cb;
+			*out++=Y;
+		}
+		while(x-=2);
+		/* copy data on edge */
+		*out++=Cr;	//dst[j+1] = Y;		// Luma
+		*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				//j += 2;
+
+		left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+		low+=(2+remain_size);high+=(2+remain_size);
+		low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+
+	}
+	while(y-=2);
+}
+
+void debayerRGB_fast_mode2(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
+{
+	int x,y;
+	int r,g,b;
+	int window_width,window_height;
+	int remain_size;
+	if(ww && wh)   // working with window in image
+	{
+	    window_width= ww-2;
+	    window_height= wh-2;
+	    remain_size= dim_x-ww;
+	    src+=(dim_x*starty+startx);
+	}
+	else
+	{
+	    window_width= dim_x-2;
+	    window_height= dim_y-2;
+	    remain_size=0;
+	}
+	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
+	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
+	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
+	uint16_t Y,Cr,Cb;
+	uint8_t *out=dst;
+
+			//for( y=1; y < dim_y - 1; y+=2 )
+			y= window_height;
+			do
+			{
+				/* blue */
+		    		r= (*low_left + *low_right + *high_left + *high_right)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+		    		g= (*low + *left + *right + *high)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    		b =  *center;							//d_RGB_y[x];
+
+				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+				//Cr= (uint8_t)(0.713*(r-Y) + 128);
+				Cr= (mul16x16s(r-Y,coefCr)+128);
+
+				/* copy data on edge */
+
+				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				*out++=Y;			//dst[j+1] = Y;		// Luma
+									//j += 2;
+				//for( x=1; x < dim_x - 1; x+=2 )
+				x= window_width;
+				do
+				{
+					/* blue */
+		    			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    			b =  *center++;							//d_RGB_y[x];
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cr= (uint8_t)(0.713*(r-Y) + 128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+
+					*out++=Cr;
+					*out++=Y;
+
+		  		    /* green 2 */
+		    			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+		    			g =  *center++;		//g=d_RGB_y[x];
+		    			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+					low_left++;low_right++;high_left++;high_right++;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cb= (uint8_t)(0.564*(b-Y) + 128);
+					Cb= (mul16x16s(b-Y,coefCb)+128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cb;
+					*out++=Y;
+				}
+				while(x-=2);
+				/* copy data on edge */
+				*out++=Cr;	//dst[j+1] = Y;		// Luma
+				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+						//j += 2;
+
+				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+				low+=(2+remain_size);high+=(2+remain_size);
+				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+				/* green 1 */
+				r = (*left + *right)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+		    		g =  *center;			//d_RGB_y[x];
+		    		b = (*low + *high)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+
+				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+				//Cr= (uint8_t)(0.713*(r-Y) + 128);
+				Cr= (mul16x16s(r-Y,coefCr)+128);
+									/* copy data on edge */
+				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				*out++=Y;			//dst[j+1] = Y;		// Luma
+								//j += 2;
+				//for( x=1; x < dim_x - 1; x+=2 )
+				x= window_width;
+				do
+				{
+						/* green 1 */
+					r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+		    			g =  *center++;			//d_RGB_y[x];
+		    			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+					low_left++;low_right++;high_left++;high_right++;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cr= (uint8_t)(0.713*(r-Y) + 128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cr;
+					*out++=Y;
+		    				/* red */
+		    			r= *center++;							  //r =  d_RGB_y[x];
+		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cb= (uint8_t)(0.564*(b-Y) + 128);
+					Cb= (mul16x16s(b-Y,coefCb)+128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cb;
+					*out++=Y;
+
+				}
+				while(x-=2);
+				/* copy data on edge */
+				*out++=Cr;	//dst[j+1] = Y;		// Luma
+				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+						//j += 2;
+
+				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+				low+=(2+remain_size);high+=(2+remain_size);
+				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+
+			}
+			while(y-=2);
+}
+
+void debayerRGB_fast_mode3(uint8_t *dst, uint8_t *src, int dim_x, int dim_y,int startx,int starty,int ww,int wh)
+{
+	int x,y;
+	int r,g,b;
+	int window_width,window_height;
+	int remain_size;
+	if(ww && wh)   // working with window in image
+	{
+	    window_width= ww-2;
+	    window_height= wh-2;
+	    remain_size= dim_x-ww;
+	    src+=(dim_x*starty+startx);
+	}
+	else
+	{
+	    window_width= dim_x-2;
+	    window_height= dim_y-2;
+	    remain_size=0;
+	}
+	uint8_t *high_left=src,*high=high_left+1,*high_right=high+1;
+	uint8_t *left=src+dim_x,*center=left+1,*right=center+1;
+	uint8_t *low_left=left+dim_x,*low=low_left+1,*low_right=low+1;
+	uint16_t Y,Cr,Cb;
+	uint8_t *out=dst;
+
+			//for( y=1; y < dim_y - 1; y+=2 )
+			y= window_height;
+			do
+			{
+		  		 /* green 2 */
+		    		r= (*low + *high)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+		    		g =  *center;		//g=d_RGB_y[x];
+		    		b= (*left + *right) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+
+				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+				//Cr= (uint8_t)(0.713*(r-Y) + 128);
+				Cr= (mul16x16s(r-Y,coefCr)+128);
+
+				/* copy data on edge */
+
+				*out++=Cr;			//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+				*out++=Y;			//dst[j+1] = Y;		// Luma
+									//j += 2;
+				//for( x=1; x < dim_x - 1; x+=2 )
+				x= window_width;
+				do
+				{
+
+		  		    	/* green 2 */
+		    			r= (*low++ + *high++)>>1; //r = (d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+		    			g =  *center++;		//g=d_RGB_y[x];
+		    			b= (*left++ + *right++) >>1; //b = (d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+					low_left++;low_right++;high_left++;high_right++;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cr= (uint8_t)(0.713*(r-Y) + 128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cr;
+					*out++=Y;
+					/* blue */
+		    			r= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //r = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			//g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    			b =  *center++;							//d_RGB_y[x];
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cb= (uint8_t)(0.564*(b-Y) + 128);
+					Cb= (mul16x16s(b-Y,coefCb)+128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cb;
+					*out++=Y;
+				}
+				while(x-=2);
+				/* copy data on edge */
+				*out++=Cr;	//dst[j+1] = Y;		// Luma
+				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+						//j += 2;
+
+				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+				low+=(2+remain_size);high+=(2+remain_size);
+				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+				/* red */
+		    		r= *center;							  //r =  d_RGB_y[x];
+		    		g= (*low + *left + *right + *high)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    		b= (*low_left + *low_right + *high_left + *high_right)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+
+				//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+				Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+				//Cr= (uint8_t)(0.713*(r-Y) + 128);
+				Cr= (mul16x16s(r-Y,coefCr)+128);
+
+				*out++=Cr;
+				*out++=Y;
+				//for( x=1; x < dim_x - 1; x+=2 )
+				x= window_width;
+				do
+				{
+
+		    				/* red */
+		    			r= *center++;							  //r =  d_RGB_y[x];
+		    			g= (*low++ + *left++ + *right++ + *high++)>>2;			  //g = (d_RGB_y_low[x]   + d_RGB_y[x-1]     + d_RGB_y[x+1]      + d_RGB_y_high[x]  ) / 4;
+		    			b= (*low_left++ + *low_right++ + *high_left++ + *high_right++)>>2; //b = (d_RGB_y_low[x-1] + d_RGB_y_low[x+1] + d_RGB_y_high[x-1] + d_RGB_y_high[x+1]) / 4;
+
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cr= (uint8_t)(0.713*(r-Y) + 128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cr;
+					*out++=Y;
+
+						/* green 1 */
+					r = (*left++ + *right++)>>1; 	//(d_RGB_y[x-1] + d_RGB_y[x+1]) / 2;
+		    			g =  *center++;			//d_RGB_y[x];
+		    			b = (*low++ + *high++)>>1;	//(d_RGB_y_low[x] + d_RGB_y_high[x]) / 2;
+					low_left++;low_right++;high_left++;high_right++;
+					//Y= (uint8_t)(0.299*r + 0.587*g + 0.114*b);
+					Y= (mul16x16s(r,coefrY)+mul16x16s(g,coefgY)+mul16x16s(b,coefbY));
+					//Cb= (uint8_t)(0.564*(b-Y) + 128);
+					Cb= (mul16x16s(b-Y,coefCb)+128);
+					Cr= (mul16x16s(r-Y,coefCr)+128);
+
+					*out++=Cb;
+					*out++=Y;
+
+				}
+				while(x-=2);
+				/* copy data on edge */
+				*out++=Cr;	//dst[j+1] = Y;		// Luma
+				*out++=Y;	//dst[j]   = CbCr[CbCr_idx];		// Cb or Cr
+						//j += 2;
+
+				left+=(2+remain_size);center+=(2+remain_size);right+=(2+remain_size);
+				low+=(2+remain_size);high+=(2+remain_size);
+				low_left+=(2+remain_size);low_right+=(2+remain_size);high_left+=(2+remain_size);high_right+=(2+remain_size);
+
+			}
+			while(y-=2);
+}
@@ -1901,6 +1901,7 @@ int arch_probe_fast_debayer(debayer_api_t *api, int dim_x, int startx, int ww)
 			_api.debayerRGB_func[1] = &debayerRGB_mode1_sse2;
 			_api.debayerRGB_func[2] = &debayerRGB_mode2_sse2;
 			_api.debayerRGB_func[3] = &debayerRGB_mode3_sse2;
+			_api.name = "SSE2";
 
 			TRACEP(0, "%s: SSE2 selected\n", __func__);
 			
@@ -1914,6 +1915,7 @@ int arch_probe_fast_debayer(debayer_api_t *api, int dim_x, int startx, int ww)
 			_api.debayerRGB_func[1] = &debayerRGB_mode1_mmx;
 			_api.debayerRGB_func[2] = &debayerRGB_mode2_mmx;
 			_api.debayerRGB_func[3] = &debayerRGB_mode3_mmx;
+			_api.name = "MMX";
 
 			TRACEP(0, "%s: MMX selected\n", __func__);
 
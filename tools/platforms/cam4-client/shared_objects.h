@@ -31,10 +31,79 @@ typedef struct hist_s {
 	uint32_t hist[300];
 } hist_t;
 
+/* capture health, refreshed about once a second by cam4_ps */
+typedef struct capture_stats_s {
+	uint32_t	seq;		/* odd while a refresh is copied in, readers retry */
+	uint32_t	last_fd_missing;	/* FD fragments missing in the last frame */
+
+	uint64_t	rx_packets;	/* seen by the capture socket(s) */
+	uint64_t	kernel_drops;	/* ring / socket buffer overflow */
+	uint64_t	queue_freezes;	/* TPACKET_V3 ring full */
+
+	uint64_t	frames;		/* FH received */
+	uint64_t	fseq_gaps;	/* frames missing by FH fseq */
+	uint64_t	fd_missing;	/* FD fragments missing when the frame completed */
+	uint64_t	fd_missing_bytes;
+	uint64_t	busy_drops;	/* frames overwritten while the consumer was busy */
+	uint64_t	slot_truncated;	/* packets cut by a capture ring slot */
+	uint64_t	fd_truncated;	/* FD size beyond the received packet */
+	uint64_t	fd_late;	/* FD of a frame already handed over */
+	uint64_t	frames_repaired;	/* missing parts filled (-z/-y) */
+	uint64_t	archive_packets;	/* written to the -P packet archive */
+	uint64_t	archive_drops;	/* not archived: queue full or write error */
+	uint64_t	stream_drops;	/* packets of camera streams beyond -N */
+	uint64_t	deadline_expired;	/* frames closed by the -T deadline */
+	uint64_t	deadline_drops;	/* of them discarded (-T ms:drop) */
+	uint64_t	fd_orphan;	/* FD with no frame open: delivered already or FH lost */
+	uint64_t	geometry_changes;	/* FH with another size or sample format */
+} capture_stats_t;
+
+/*
+ * Frame latency per stage, us of the host clock (the camera time stamp
+ * too, so the camera stages need synchronized clocks).  Bucket k counts
+ * [2^k, 2^(k+1)) us, bucket 0 also 0 and the last one everything above.
+ */
+#define LAT_BUCKETS	24
+
+enum lat_stage {
+	LAT_WIRE,			/* camera ts -> first FD arrived */
+	LAT_REASSEMBLY,			/* first -> last FD arrived */
+	LAT_LUT,			/* last FD -> LUT done, queueing included */
+	LAT_PUBLISH,			/* LUT done -> debayered into shared memory */
+	LAT_TOTAL,			/* camera ts -> shared memory */
+	LAT_STAGES
+};
+
+typedef struct latency_stats_s {
+	uint32_t	seq;		/* odd while a frame is copied in, readers retry */
+	uint32_t	clock_skew;	/* frames that came before their camera ts */
+	uint64_t	frames;
+	uint64_t	sum[LAT_STAGES];	/* us, for the mean */
+	uint32_t	max[LAT_STAGES];
+	uint32_t	hist[LAT_STAGES][LAT_BUCKETS];
+} latency_stats_t;
+
+/* regions of a frame that never arrived, the last run may cover more than one */
+#define FRAME_MISSING_RUNS	32
+
+typedef struct frame_run_s {
+	uint32_t	start;
+	uint32_t	count;
+} frame_run_t;
+
 typedef struct common_s {
 	uint8_t		frame_idx_done;
 	uint8_t		frame_done;
 
+	/*
+	 * frame_idx_done came incomplete: its missing pixels (of the
+	 * sensWidth x sensHeight frame) in frame_missing, filled by -z/-y
+	 * or left as they were
+	 */
+	uint8_t		frame_partial;
+	uint8_t		frame_nmissing;
+	frame_run_t	frame_missing[FRAME_MISSING_RUNS];
+
 	uint16_t	xvHeight;
 	uint16_t	xvWidth;
 
@@ -49,6 +118,7 @@ typedef struct common_s {
 
 	size_t		data_size;
 	size_t		image_size;
+	uint32_t	geometry_seq;	/* bumped when the yuv segments were remade */
 
 	char		window_title[40];
 
@@ -72,10 +142,15 @@ typedef struct common_s {
 	uint32_t	reg1;
 	uint32_t	reg2;
 
+	capture_stats_t	capture;
+	latency_stats_t	latency;
 } common_t;
 
 #define	key_yuv1	(6182)
 #define key_yuv2	(6193)
 #define key_common	(12348)
 
+/* segments of camera stream n of cam4_ps -N, stream 0 uses the keys above */
+#define key_stream(key, n)	((key) + ((n) << 16))
+
 #endif
@@ -45,6 +45,8 @@ typedef struct {
 
 	uint32_t           width;
 	uint32_t           height;
+	uint32_t           roi_width;	/* -r: geometry switched to every second, 0 - none */
+	uint32_t           roi_height;
 	uint32_t           flow_id;
 	uint32_t           fragment_payload;
 	uint32_t           fps;
@@ -122,7 +124,7 @@ static int send_frame(tx_ctx_t *ctx, uint16_t *frame_buf)
 	/* prepare FH */
 	video_frame_raw_hdr_t fh;
 	memset(&fh, 0, sizeof(fh));
-	fh.lid   = (uint32_t)LID_FH | (ctx->flow_id & 0x7fffffff);
+	fh.lid   = htonl((uint32_t)LID_FH | (ctx->flow_id & 0x7fffffff));
 	fh.fseq  = htonl(fseq32);
 	fh.ts    = htobe64(monotonic_us() - ctx->ts_origin_ns / 1000ull);
 	fh.x_dim = htons((uint16_t)ctx->width);
@@ -151,7 +153,7 @@ static int send_frame(tx_ctx_t *ctx, uint16_t *frame_buf)
 			return -1;
 		}
 
-		fd->lid    = (ctx->flow_id & 0x7fffffff) | (uint32_t)LID_FD;
+		fd->lid    = htonl((ctx->flow_id & 0x7fffffff) | (uint32_t)LID_FD);
 		fd->flags  = 4; /* colour mode: BW */
 		fd->fseq   = fseq8;
 		fd->size   = htons((uint16_t)chunk);
@@ -204,8 +206,9 @@ static void usage(const char *prog)
 	fprintf(stderr,
 	        "Usage: %s -d <dst_ip> [-p <dst_port>] [-c <ctrl_port>] "
 	        "[-w <width>] [-h <height>] [-f <fps>] [-m <fragment bytes>] "
-	        "[-l <flow_id>] [-t pattern]\n"
-	        "Patterns: 0=gradient (default), 1=flat, 2=checker, 3=noise\n",
+	        "[-l <flow_id>] [-t pattern] [-r <roi_width>x<roi_height>]\n"
+	        "Patterns: 0=gradient (default), 1=flat, 2=checker, 3=noise\n"
+	        "-r alternates the frame size with the ROI once a second\n",
 	        prog);
 }
 
@@ -237,7 +240,7 @@ int main(int argc, char **argv)
 	uint16_t ctrl_port = DEFAULT_CTRL;
 	uint16_t data_port = DEFAULT_PORT;
 	int opt;
-	while ((opt = getopt(argc, argv, "d:p:c:w:h:f:m:l:t:")) != -1) {
+	while ((opt = getopt(argc, argv, "d:p:c:w:h:f:m:l:t:r:")) != -1) {
 		switch (opt) {
 		case 'd':
 			dst_ip = optarg;
@@ -263,6 +266,13 @@ int main(int argc, char **argv)
 		case 'l':
 			ctx.flow_id = (uint32_t)atoi(optarg);
 			break;
+		case 'r':
+			if (sscanf(optarg, "%ux%u", &ctx.roi_width, &ctx.roi_height) != 2 ||
+			    !ctx.roi_width || !ctx.roi_height) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
 		case 't': {
 			int p = atoi(optarg);
 			if (p < PATTERN_GRADIENT || p > PATTERN_NOISE) {
@@ -325,15 +335,26 @@ int main(int argc, char **argv)
 	signal(SIGTERM, handle_sig);
 
 	size_t frame_bytes = (size_t)ctx.width * ctx.height * sizeof(uint16_t);
-	uint16_t *frame = malloc(frame_bytes);
+	size_t roi_bytes = (size_t)ctx.roi_width * ctx.roi_height * sizeof(uint16_t);
+	uint16_t *frame = malloc(roi_bytes > frame_bytes ? roi_bytes : frame_bytes);
 	if (!frame) {
 		perror("malloc frame");
 		return 1;
 	}
 
 	uint32_t frame_interval_us = (ctx.fps > 0) ? (1000000u / ctx.fps) : 0;
+	uint32_t sent = 0;
 	while (!ctx.stop) {
 		if (ctx.run) {
+			/* -r: the sensor mode changes under the client */
+			if (ctx.roi_width && sent++ && !(sent % (ctx.fps ? ctx.fps : 1))) {
+				uint32_t w = ctx.width, h = ctx.height;
+
+				ctx.width = ctx.roi_width;
+				ctx.height = ctx.roi_height;
+				ctx.roi_width = w;
+				ctx.roi_height = h;
+			}
 			synthetic_frame(&ctx, frame, ctx.fseq);
 			if (send_frame(&ctx, frame) != 0) {
 				break;